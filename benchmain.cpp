@@ -0,0 +1,401 @@
+// secretcalc-bench: times the engine's arithmetic and the formula pipeline
+// over a fixed set of operand sizes. Results print as a table or as JSON;
+// given a baseline written by an earlier --json run, every benchmark is
+// compared against it and slowdowns beyond the threshold fail the run.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "formula.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const char kUsage[] =
+    "usage: secretcalc-bench [--json] [--baseline FILE] [--threshold PCT]\n"
+    "                        [--filter TEXT] [--max-digits N] [--min-time SEC]\n"
+    "                        [--threads N]\n"
+    "\n"
+    "  --json          print results as JSON instead of a table\n"
+    "  --baseline FILE compare with the JSON of an earlier run; exits with 1\n"
+    "                  when a benchmark got slower by more than the threshold\n"
+    "  --threshold PCT allowed slowdown against the baseline (default 10)\n"
+    "  --filter TEXT   run only benchmarks whose name contains TEXT\n"
+    "  --max-digits N  largest operand size (default 1000000)\n"
+    "  --min-time SEC  time spent measuring each benchmark (default 0.5)\n"
+    "  --threads N     threads for large multiplications and divisions\n"
+    "                  (default: one per hardware thread)\n";
+
+constexpr int kRepetitions = 5;
+
+struct Options {
+    bool json = false;
+    std::string baseline;
+    double threshold = 10.0;
+    std::string filter;
+    long max_digits = 1000000;
+    double min_time = 0.5;
+    // Zero keeps BigNumber's default.
+    std::size_t threads = 0;
+};
+
+struct Benchmark {
+    std::string name;
+    // Prepares the operands, which are not timed, and returns one iteration.
+    std::function<std::function<void()>()> setup;
+};
+
+struct Result {
+    std::string name;
+    std::size_t iterations = 0;
+    // Fastest and median time per iteration over kRepetitions batches. The
+    // fastest is what baselines compare, being the least disturbed by noise.
+    double ns_per_op = 0;
+    double median_ns = 0;
+};
+
+// Keeps the compiler from dropping a computation whose result is unused.
+template <typename T>
+void Consume(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+#endif
+}
+
+std::string RandomDigits(std::mt19937_64& rng, std::size_t count) {
+    std::uniform_int_distribution<int> digit(0, 9);
+    std::string out(count, '0');
+    for (char& c : out)
+        c = static_cast<char>('0' + digit(rng));
+    out[0] = static_cast<char>('1' + digit(rng) % 9);
+    return out;
+}
+
+// A random number with `digits` significant digits, a tenth of them after
+// the decimal point.
+std::string RandomNumber(std::mt19937_64& rng, std::size_t digits) {
+    std::string text = RandomDigits(rng, digits);
+    const std::size_t fraction = digits / 10;
+    if (fraction > 0)
+        text.insert(text.size() - fraction, ".");
+    return text;
+}
+
+// "a op b op c ..." with `terms` operands of a few digits each; the
+// operators cycle through + - * / so every opcode is exercised.
+std::string RandomExpression(std::mt19937_64& rng, std::size_t terms) {
+    static const char kOps[] = "+-*/";
+    std::string out;
+    for (std::size_t i = 0; i < terms; ++i) {
+        if (i > 0)
+            out += kOps[i % 4];
+        out += RandomNumber(rng, 1 + rng() % 8);
+    }
+    return out;
+}
+
+std::vector<std::size_t> Sizes(long max_digits) {
+    std::vector<std::size_t> out;
+    for (std::size_t n = 1; n <= static_cast<std::size_t>(max_digits); n *= 10)
+        out.push_back(n);
+    return out;
+}
+
+std::vector<Benchmark> NumberBenchmarks(long max_digits) {
+    std::vector<Benchmark> out;
+    for (std::size_t n : Sizes(max_digits)) {
+        const std::string size = "/" + std::to_string(n);
+        // Every benchmark draws its operands from its own seed, so a filtered
+        // run times the same numbers as a full one.
+        const auto operands = [n](std::size_t a_digits) {
+            std::mt19937_64 rng(n);
+            const BigNumber a(RandomNumber(rng, a_digits));
+            const BigNumber b(RandomNumber(rng, n));
+            return std::make_pair(a, b);
+        };
+
+        out.push_back({"parse" + size, [n] {
+            std::mt19937_64 rng(n);
+            return [text = RandomNumber(rng, n)] { Consume(BigNumber(text)); };
+        }});
+        out.push_back({"format" + size, [operands, n] {
+            return [a = operands(n).first] { Consume(a.ToStdString()); };
+        }});
+        out.push_back({"add" + size, [operands, n] {
+            return [ab = operands(n)] { Consume(ab.first + ab.second); };
+        }});
+        out.push_back({"sub" + size, [operands, n] {
+            return [ab = operands(n)] { Consume(ab.first - ab.second); };
+        }});
+        out.push_back({"mul" + size, [operands, n] {
+            return [ab = operands(n)] { Consume(ab.first * ab.second); };
+        }});
+        // A 2n-digit dividend over an n-digit divisor, rounded to n digits:
+        // the quotient is as long as the divisor.
+        out.push_back({"div" + size, [operands, n] {
+            const BigNumber::Context context{static_cast<int>(n),
+                                             BigNumber::RoundingMode::kHalfEven};
+            return [ab = operands(2 * n), context] {
+                Consume(ab.first.Divide(ab.second, context));
+            };
+        }});
+        // Equal up to the last digit, so the whole magnitude is scanned.
+        out.push_back({"compare" + size, [n] {
+            std::mt19937_64 rng(n);
+            std::string text = RandomDigits(rng, n);
+            const BigNumber a(text);
+            text.back() = (text.back() == '9') ? '8' : static_cast<char>(text.back() + 1);
+            return [a, b = BigNumber(text)] { Consume(BigNumber::Compare(a, b)); };
+        }});
+    }
+    return out;
+}
+
+std::vector<Benchmark> FormulaBenchmarks() {
+    std::vector<Benchmark> out;
+    // Tokenizing and the shunting-yard pass both happen in Formula::Compile;
+    // Evaluate runs the resulting bytecode.
+    const std::pair<const char*, std::size_t> kLengths[] = {
+        {"short", 8}, {"long", 10000}};
+    for (const auto& [label, terms] : kLengths) {
+        const std::string suffix = std::string("/") + label;
+        const auto expression = [terms = terms] {
+            std::mt19937_64 rng(terms);
+            return RandomExpression(rng, terms);
+        };
+
+        out.push_back({"compile" + suffix, [expression] {
+            return [text = expression()] { Consume(Formula::Compile(text)); };
+        }});
+        out.push_back({"compile-unoptimized" + suffix, [expression] {
+            return [text = expression()] { Consume(Formula::Compile(text, false)); };
+        }});
+        out.push_back({"evaluate-decimal" + suffix, [expression] {
+            return [program = Formula::Compile(expression(), false)] {
+                Consume(program.Evaluate<BigNumber>());
+            };
+        }});
+        out.push_back({"evaluate-exact" + suffix, [expression] {
+            return [program = Formula::Compile(expression(), false)] {
+                Consume(program.Evaluate<BigRational>());
+            };
+        }});
+    }
+    return out;
+}
+
+double BatchSeconds(const std::function<void()>& body, std::size_t iterations) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        body();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+Result Run(const Benchmark& benchmark, double min_time) {
+    const std::function<void()> body = benchmark.setup();
+
+    // Grow the batch until it fills its share of min_time; the first batch
+    // also warms caches and allocator pools.
+    const double batch_time = min_time / kRepetitions;
+    std::size_t iterations = 1;
+    double seconds = BatchSeconds(body, iterations);
+    while (seconds < batch_time && iterations < (std::size_t(1) << 40)) {
+        const double factor = (seconds > 0) ? 1.2 * batch_time / seconds : 10.0;
+        iterations = static_cast<std::size_t>(
+            iterations * std::min(std::max(factor, 1.5), 10.0));
+        seconds = BatchSeconds(body, iterations);
+    }
+
+    std::vector<double> samples{seconds};
+    while (samples.size() < kRepetitions)
+        samples.push_back(BatchSeconds(body, iterations));
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.ns_per_op = samples.front() * 1e9 / iterations;
+    result.median_ns = samples[samples.size() / 2] * 1e9 / iterations;
+    return result;
+}
+
+// Reads the "name" and "ns_per_op" pairs of a file written with --json.
+// This is not a general JSON parser; it relies on the layout written below.
+std::map<std::string, double> ReadBaseline(const std::string& path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot open " + path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+
+    std::map<std::string, double> out;
+    const std::string name_key = "\"name\": \"";
+    const std::string time_key = "\"ns_per_op\": ";
+    for (std::size_t pos = text.find(name_key); pos != std::string::npos;
+         pos = text.find(name_key, pos)) {
+        pos += name_key.size();
+        const std::size_t name_end = text.find('"', pos);
+        const std::size_t time_pos = text.find(time_key, pos);
+        if (name_end == std::string::npos || time_pos == std::string::npos)
+            throw std::runtime_error("malformed baseline " + path);
+        out[text.substr(pos, name_end - pos)] =
+            std::strtod(text.c_str() + time_pos + time_key.size(), nullptr);
+        pos = time_pos;
+    }
+    if (out.empty())
+        throw std::runtime_error("no benchmarks in baseline " + path);
+    return out;
+}
+
+// Relative change against the baseline in percent; positive is slower.
+double Change(const Result& result, double baseline_ns) {
+    return (result.ns_per_op / baseline_ns - 1.0) * 100.0;
+}
+
+void PrintJson(const std::vector<Result>& results, const Options& options,
+               const std::map<std::string, double>& baseline) {
+    std::printf("{\n  \"min_time\": %g,\n  \"benchmarks\": [\n", options.min_time);
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::printf("    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, "
+                    "\"median_ns\": %.1f",
+                    r.name.c_str(), r.iterations, r.ns_per_op, r.median_ns);
+        const auto it = baseline.find(r.name);
+        if (it != baseline.end()) {
+            const double change = Change(r, it->second);
+            std::printf(", \"baseline_ns\": %.1f, \"change_pct\": %.1f, \"regression\": %s",
+                        it->second, change, change > options.threshold ? "true" : "false");
+        }
+        std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+void PrintTable(const std::vector<Result>& results, const Options& options,
+                const std::map<std::string, double>& baseline) {
+    std::printf("%-32s %14s %14s %12s", "benchmark", "ns/op", "median ns", "iterations");
+    if (!baseline.empty())
+        std::printf(" %14s %9s", "baseline ns", "change");
+    std::printf("\n");
+    for (const Result& r : results) {
+        std::printf("%-32s %14.1f %14.1f %12zu", r.name.c_str(), r.ns_per_op, r.median_ns,
+                    r.iterations);
+        const auto it = baseline.find(r.name);
+        if (it != baseline.end()) {
+            const double change = Change(r, it->second);
+            std::printf(" %14.1f %+8.1f%%%s", it->second, change,
+                        change > options.threshold ? "  REGRESSION" : "");
+        } else if (!baseline.empty()) {
+            std::printf(" %14s", "new");
+        }
+        std::printf("\n");
+    }
+}
+
+bool ParseDouble(const char* text, double min, double* out) {
+    char* end = nullptr;
+    const double value = std::strtod(text, &end);
+    if (end == text || *end != '\0' || !(value >= min))
+        return false;
+    *out = value;
+    return true;
+}
+
+// Returns false after printing a message when the arguments are unusable.
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        double value = 0;
+        if (arg == "-h" || arg == "--help") {
+            std::fputs(kUsage, stdout);
+            std::exit(0);
+        } else if (arg == "--json") {
+            options->json = true;
+        } else if (arg == "--baseline" && has_value) {
+            options->baseline = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            options->filter = argv[++i];
+        } else if (arg == "--threshold" && has_value && ParseDouble(argv[i + 1], 0, &value)) {
+            options->threshold = value;
+            ++i;
+        } else if (arg == "--max-digits" && has_value && ParseDouble(argv[i + 1], 1, &value)) {
+            options->max_digits = static_cast<long>(value);
+            ++i;
+        } else if (arg == "--min-time" && has_value && ParseDouble(argv[i + 1], 0, &value)) {
+            options->min_time = value;
+            ++i;
+        } else if (arg == "--threads" && has_value && ParseDouble(argv[i + 1], 1, &value)) {
+            options->threads = static_cast<std::size_t>(value);
+            ++i;
+        } else {
+            std::fputs(kUsage, stderr);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+        return 2;
+
+    if (options.threads != 0) {
+        BigNumber::Tuning tuning = BigNumber::GetTuning();
+        tuning.threads = options.threads;
+        BigNumber::SetTuning(tuning);
+    }
+
+    try {
+        std::map<std::string, double> baseline;
+        if (!options.baseline.empty())
+            baseline = ReadBaseline(options.baseline);
+
+        std::vector<Benchmark> benchmarks = NumberBenchmarks(options.max_digits);
+        for (Benchmark& b : FormulaBenchmarks())
+            benchmarks.push_back(std::move(b));
+
+        std::vector<Result> results;
+        for (const Benchmark& benchmark : benchmarks) {
+            if (benchmark.name.find(options.filter) == std::string::npos)
+                continue;
+            results.push_back(Run(benchmark, options.min_time));
+        }
+
+        if (options.json)
+            PrintJson(results, options, baseline);
+        else
+            PrintTable(results, options, baseline);
+
+        for (const Result& r : results) {
+            const auto it = baseline.find(r.name);
+            if (it != baseline.end() && Change(r, it->second) > options.threshold)
+                return 1;
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "secretcalc-bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
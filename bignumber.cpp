@@ -1,471 +1,2445 @@
 #include "bignumber.h"
+#include "threadpool.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(SECRETCALC_NO_SIMD)
+#define SECRETCALC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Digits are checked and converted eight at a time inside a 64-bit word,
+// which needs the first character in the lowest byte.
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+    defined(_MSC_VER)
+#define SECRETCALC_SWAR_DIGITS 1
+#endif
+
 namespace {
 
-constexpr int kDefaultDivPrecision = 40;
+using Limb = std::uint32_t;
+using Limbs = std::vector<Limb>;
+
+constexpr Limb kBase = 1000000000;
+constexpr int kBaseDigits = 9;
+
+constexpr Limb kPow10[kBaseDigits + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
 
-bool IsAllDigits(const std::string& s) {
-    return std::all_of(s.begin(), s.end(),
-                       [](unsigned char c) { return std::isdigit(c) != 0; });
+bool IsDigitChar(char c) {
+    return c >= '0' && c <= '9';
 }
 
-int CompareIntStrings(const std::string& a, const std::string& b) {
-    if (a.size() != b.size())
-        return (a.size() < b.size()) ? -1 : 1;
-    if (a == b)
-        return 0;
-    return (a < b) ? -1 : 1;
+#if defined(SECRETCALC_SWAR_DIGITS)
+
+std::uint64_t LoadEight(const char* p) {
+    std::uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// True when all eight bytes of v are ASCII digits: each must have a high
+// nibble of 3 both as it is and after adding 6.
+bool AllDigits(std::uint64_t v) {
+    constexpr std::uint64_t kHigh = 0xF0F0F0F0F0F0F0F0;
+    return ((v & kHigh) | (((v + 0x0606060606060606) & kHigh) >> 4)) == 0x3333333333333333;
+}
+
+// Value of the eight ASCII digits in v, first character most significant:
+// adjacent digits are combined into pairs, then pairs into the result.
+Limb EightDigitsValue(std::uint64_t v) {
+    v -= 0x3030303030303030;
+    v = v * 10 + (v >> 8);
+    v = (((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >> 32;
+    return static_cast<Limb>(v);
+}
+
+#endif // SECRETCALC_SWAR_DIGITS
+
+// Index of the first character at or after pos that is not a digit.
+size_t SkipDigits(std::string_view s, size_t pos) {
+#if defined(SECRETCALC_SWAR_DIGITS)
+    while (pos + 8 <= s.size() && AllDigits(LoadEight(s.data() + pos)))
+        pos += 8;
+#endif
+    while (pos < s.size() && IsDigitChar(s[pos]))
+        ++pos;
+    return pos;
+}
+
+// Value of the kBaseDigits digits at p.
+Limb LimbValue(const char* p) {
+#if defined(SECRETCALC_SWAR_DIGITS)
+    return EightDigitsValue(LoadEight(p)) * 10 + static_cast<Limb>(p[8] - '0');
+#else
+    Limb limb = 0;
+    for (int k = 0; k < kBaseDigits; ++k)
+        limb = limb * 10 + static_cast<Limb>(p[k] - '0');
+    return limb;
+#endif
 }
 
-std::string MulIntStringByDigit(const std::string& a, int digit) {
-    if (digit == 0 || a == "0")
-        return "0";
-    int carry = 0;
-    std::string out;
-    out.reserve(a.size() + 1);
-    for (int i = static_cast<int>(a.size()) - 1; i >= 0; --i) {
-        int x = (a[i] - '0') * digit + carry;
-        out.push_back(static_cast<char>('0' + (x % 10)));
-        carry = x / 10;
+// Calls emit with each limb of the decimal digits of `high` followed by
+// those of `low`, least significant first, reading the digits in place
+// rather than joining them into one string first.
+template <typename Emit>
+void ForEachLimb(std::string_view high, std::string_view low, Emit emit) {
+    size_t end = high.size() + low.size();
+    while (end > 0) {
+        const size_t begin = (end > kBaseDigits) ? end - kBaseDigits : 0;
+        if (end - begin == kBaseDigits && begin >= high.size()) {
+            emit(LimbValue(low.data() + (begin - high.size())));
+        } else if (end - begin == kBaseDigits && end <= high.size()) {
+            emit(LimbValue(high.data() + begin));
+        } else {
+            // The leading chunk, or the one that straddles the decimal point.
+            Limb limb = 0;
+            for (size_t k = begin; k < end; ++k) {
+                const char c = (k < high.size()) ? high[k] : low[k - high.size()];
+                limb = limb * 10 + static_cast<Limb>(c - '0');
+            }
+            emit(limb);
+        }
+        end = begin;
     }
-    while (carry > 0) {
-        out.push_back(static_cast<char>('0' + (carry % 10)));
-        carry /= 10;
+}
+
+Limbs LimbsFromDigits(std::string_view high, std::string_view low) {
+    Limbs out;
+    out.reserve((high.size() + low.size()) / kBaseDigits + 1);
+    ForEachLimb(high, low, [&out](Limb limb) { out.push_back(limb); });
+    while (!out.empty() && out.back() == 0)
+        out.pop_back();
+    return out;
+}
+
+constexpr std::array<char, 200> MakeDigitPairs() {
+    std::array<char, 200> out{};
+    for (int i = 0; i < 100; ++i) {
+        out[2 * i] = static_cast<char>('0' + i / 10);
+        out[2 * i + 1] = static_cast<char>('0' + i % 10);
     }
-    std::reverse(out.begin(), out.end());
     return out;
 }
 
-} // namespace
+constexpr std::array<char, 200> kDigitPairs = MakeDigitPairs();
+
+// Writes the kBaseDigits digits of v, zero-padded, two at a time.
+void WriteLimbDigits(Limb v, char* out) {
+    out[0] = static_cast<char>('0' + v / 100000000);
+    v %= 100000000;
+    const Limb high = v / 10000;
+    const Limb low = v % 10000;
+    std::memcpy(out + 1, &kDigitPairs[2 * (high / 100)], 2);
+    std::memcpy(out + 3, &kDigitPairs[2 * (high % 100)], 2);
+    std::memcpy(out + 5, &kDigitPairs[2 * (low / 100)], 2);
+    std::memcpy(out + 7, &kDigitPairs[2 * (low % 100)], 2);
+}
 
-BigNumber::BigNumber() : digits_("0"), scale_(0), negative_(false) {}
+int DecimalDigits(Limb v) {
+    int digits = 1;
+    while (digits < kBaseDigits && v >= kPow10[digits])
+        ++digits;
+    return digits;
+}
 
-BigNumber::BigNumber(const QString& s) : BigNumber(s.toStdString()) {}
+// Limb i of x * 10^digits, computed on the fly instead of materializing the
+// shifted number.
+Limb ShiftedLimb(const Limb* x, size_t n, int digits, size_t i) {
+    const size_t whole = static_cast<size_t>(digits / kBaseDigits);
+    const int part = digits % kBaseDigits;
+    if (i < whole)
+        return 0;
+    const size_t j = i - whole;
+    if (part == 0)
+        return (j < n) ? x[j] : 0;
+    const Limb low = (j < n) ? (x[j] % kPow10[kBaseDigits - part]) * kPow10[part] : 0;
+    const Limb high = (j >= 1 && j - 1 < n) ? x[j - 1] / kPow10[kBaseDigits - part] : 0;
+    return low + high;
+}
 
-BigNumber::BigNumber(const std::string& s) : BigNumber(Parse(s)) {}
+// Exponents are kept well inside int so scale arithmetic cannot overflow:
+// Normalize rejects any result whose scale leaves +-kMaxScale, so the sum or
+// difference of two scales always fits.
+constexpr long long kMaxScale = 100000000;
 
-BigNumber BigNumber::Zero() {
-    return BigNumber();
+// Parses the signed decimal exponent that follows 'e' in s[pos..].
+long long ParseExponent(std::string_view s, size_t pos) {
+    bool neg = false;
+    if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+        neg = (s[pos] == '-');
+        ++pos;
+    }
+    if (pos >= s.size())
+        throw std::invalid_argument("BigNumber: exponent without digits");
+
+    long long value = 0;
+    for (; pos < s.size(); ++pos) {
+        const unsigned char c = static_cast<unsigned char>(s[pos]);
+        if (!std::isdigit(c))
+            throw std::invalid_argument("BigNumber: invalid char");
+        value = value * 10 + (c - '0');
+        if (value > kMaxScale)
+            throw std::invalid_argument("BigNumber: exponent out of range");
+    }
+    return neg ? -value : value;
 }
 
-BigNumber BigNumber::One() {
-    return BigNumber::FromParts("1", 0, false);
+// The process-wide Tuning, field by field, since SetTuning() may run while
+// other threads multiply. A computation that overlaps a change can see some
+// old and some new fields; every combination is valid.
+struct SharedTuning {
+    std::atomic<std::size_t> karatsuba_threshold{BigNumber::Tuning{}.karatsuba_threshold};
+    std::atomic<std::size_t> toom3_threshold{BigNumber::Tuning{}.toom3_threshold};
+    std::atomic<std::size_t> ntt_threshold{BigNumber::Tuning{}.ntt_threshold};
+    std::atomic<std::size_t> newton_div_threshold{BigNumber::Tuning{}.newton_div_threshold};
+    std::atomic<std::size_t> parallel_threshold{BigNumber::Tuning{}.parallel_threshold};
+    std::atomic<std::size_t> threads{BigNumber::Tuning{}.threads};
+};
+
+SharedTuning g_tuning;
+
+// Relaxed read of one field of g_tuning.
+std::size_t Tuned(const std::atomic<std::size_t>& field) {
+    return field.load(std::memory_order_relaxed);
 }
 
-BigNumber BigNumber::FromParts(std::string digits, int scale, bool negative) {
-    BigNumber n;
-    n.digits_ = std::move(digits);
-    n.scale_ = scale;
-    n.negative_ = negative;
-    n.Normalize();
-    return n;
+thread_local BigNumber::Context g_context;
+thread_local const BigNumber::ComputeControl* g_control = nullptr;
+
+// Called by the kernels between units of work that are cheap next to the
+// check, so cancellation is noticed within milliseconds.
+void PollCancelled() {
+    if (g_control && g_control->IsCancelled())
+        throw BigNumber::Cancelled();
 }
 
-BigNumber BigNumber::Parse(const std::string& input) {
-    std::string s;
-    s.reserve(input.size());
-    for (unsigned char c : input) {
-        if (!std::isspace(c))
-            s.push_back(static_cast<char>(c));
+// Progress is tracked as nested steps: a kernel that calls others gives
+// each call a share of its own range, and a loop reports how far through
+// its range it is. The outermost step on a thread spans [0, 1].
+struct ProgressFrame {
+    double base = 0;
+    double width = 1;
+    double done = 0;
+};
+
+thread_local ProgressFrame g_progress;
+thread_local int g_progress_depth = 0;
+// Set while running work handed off by another thread: it still polls for
+// cancellation, but only the thread that owns the step reports progress.
+thread_local bool g_progress_muted = false;
+
+class ProgressStep final {
+public:
+    // Takes the next `share` of the enclosing step's range.
+    explicit ProgressStep(double share) : share_(share) {
+        if (g_progress_depth++ == 0)
+            g_progress = ProgressFrame{};
+        parent_ = g_progress;
+        g_progress = {parent_.base + parent_.done * parent_.width,
+                      parent_.width * share, 0};
     }
 
-    if (s.empty())
-        throw std::invalid_argument("BigNumber: empty string");
+    ~ProgressStep() {
+        --g_progress_depth;
+        parent_.done += share_;
+        g_progress = parent_;
+    }
 
-    bool neg = false;
-    size_t pos = 0;
-    if (s[0] == '+') {
-        pos = 1;
-    } else if (s[0] == '-') {
-        neg = true;
-        pos = 1;
+    ProgressStep(const ProgressStep&) = delete;
+    ProgressStep& operator=(const ProgressStep&) = delete;
+
+private:
+    double share_;
+    ProgressFrame parent_;
+};
+
+// Reports `done` of the current step and polls for cancellation.
+void Checkpoint(double done) {
+    if (!g_control)
+        return;
+    if (!g_progress_muted) {
+        g_progress.done = done;
+        const_cast<BigNumber::ComputeControl*>(g_control)->SetProgress(
+            g_progress.base + done * g_progress.width);
     }
+    PollCancelled();
+}
 
-    if (pos >= s.size())
-        throw std::invalid_argument("BigNumber: sign without digits");
+// Threads for large multiplications: the caller plus the workers of a pool
+// shared by the whole process. SetTuning() swaps the pool out when the
+// thread count changes; computations still using the old one keep it alive.
+std::mutex g_pool_mutex;
+std::shared_ptr<ThreadPool> g_pool;
+// The pool the calling thread may hand work to, or nullptr.
+thread_local ThreadPool* g_current_pool = nullptr;
+
+std::shared_ptr<ThreadPool> SharedPool() {
+    const std::lock_guard<std::mutex> lock(g_pool_mutex);
+    if (!g_pool) {
+        std::size_t threads = Tuned(g_tuning.threads);
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > 1)
+            g_pool = std::make_shared<ThreadPool>(threads - 1);
+    }
+    return g_pool;
+}
 
-    std::string int_part;
-    std::string frac_part;
-    bool seen_dot = false;
+// Makes the shared pool available to the kernels for the lifetime of the
+// guard when the product is large enough to be worth splitting. Work
+// running on the pool already has it.
+class ParallelScope final {
+public:
+    explicit ParallelScope(size_t limbs) {
+        if (g_current_pool || limbs < Tuned(g_tuning.parallel_threshold))
+            return;
+        pool_ = SharedPool();
+        g_current_pool = pool_.get();
+    }
 
-    for (; pos < s.size(); ++pos) {
-        char c = s[pos];
-        if (c == '.') {
-            if (seen_dot)
-                throw std::invalid_argument("BigNumber: multiple dots");
-            seen_dot = true;
-            continue;
-        }
-        if (!std::isdigit(static_cast<unsigned char>(c)))
-            throw std::invalid_argument("BigNumber: invalid char");
-        if (!seen_dot)
-            int_part.push_back(c);
-        else
-            frac_part.push_back(c);
+    ~ParallelScope() {
+        if (pool_)
+            g_current_pool = nullptr;
     }
 
-    if (int_part.empty() && frac_part.empty())
-        throw std::invalid_argument("BigNumber: no digits");
+    ParallelScope(const ParallelScope&) = delete;
+    ParallelScope& operator=(const ParallelScope&) = delete;
 
-    if (int_part.empty())
-        int_part = "0";
+private:
+    std::shared_ptr<ThreadPool> pool_;
+};
 
-    StripLeadingZeros(int_part);
-    if (int_part.empty())
-        int_part = "0";
+// Whether a product whose smaller factor has `limbs` limbs is split across
+// threads.
+bool RunsInParallel(size_t limbs) {
+    return g_current_pool && limbs >= Tuned(g_tuning.parallel_threshold);
+}
+
+// Installs the submitting thread's context, control and pool on the thread
+// that runs a handed-off task, and restores that thread's own afterwards:
+// a thread waiting for its tasks may run someone else's in the meantime.
+class BorrowedThreadState final {
+public:
+    BorrowedThreadState(ThreadPool* pool, const BigNumber::Context& context,
+                        const BigNumber::ComputeControl* control)
+        : context_(g_context), control_(g_control), pool_(g_current_pool),
+          progress_(g_progress), depth_(g_progress_depth), muted_(g_progress_muted) {
+        g_context = context;
+        g_control = control;
+        g_current_pool = pool;
+        g_progress = ProgressFrame{};
+        g_progress_depth = 1;
+        g_progress_muted = true;
+    }
+
+    ~BorrowedThreadState() {
+        g_context = context_;
+        g_control = control_;
+        g_current_pool = pool_;
+        g_progress = progress_;
+        g_progress_depth = depth_;
+        g_progress_muted = muted_;
+    }
+
+    BorrowedThreadState(const BorrowedThreadState&) = delete;
+    BorrowedThreadState& operator=(const BorrowedThreadState&) = delete;
+
+private:
+    BigNumber::Context context_;
+    const BigNumber::ComputeControl* control_;
+    ThreadPool* pool_;
+    ProgressFrame progress_;
+    int depth_;
+    bool muted_;
+};
+
+// Runs the tasks on the pool, each as a `share` of the current progress
+// step: all but the first are queued while the calling thread runs the
+// first and then helps with queued work until the rest are done. The first
+// exception is rethrown once every task has finished, since the tasks refer
+// to the caller's locals.
+void ForkJoinOnPool(double share, const std::function<void()>* tasks, size_t count) {
+    ThreadPool* pool = g_current_pool;
+    const BigNumber::Context context = g_context;
+    const BigNumber::ComputeControl* control = g_control;
+    std::vector<std::future<void>> pending;
+    pending.reserve(count - 1);
+    for (size_t i = 1; i < count; ++i) {
+        pending.push_back(pool->Submit([pool, context, control, task = &tasks[i]] {
+            const BorrowedThreadState state(pool, context, control);
+            (*task)();
+        }));
+    }
 
-    while (!frac_part.empty() && frac_part.back() == '0') {
-        frac_part.pop_back();
+    std::exception_ptr error;
+    try {
+        const ProgressStep step(share);
+        tasks[0]();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (std::future<void>& future : pending) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!pool->RunPendingTask())
+                future.wait_for(std::chrono::microseconds(50));
+        }
+        try {
+            future.get();
+        } catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
     }
+    if (error)
+        std::rethrow_exception(error);
+    // The other tasks reported nothing; account for their shares now.
+    if (g_progress_depth > 0)
+        Checkpoint(g_progress.done + share * static_cast<double>(count - 1));
+}
 
-    std::string digits = int_part + frac_part;
-    int scale = static_cast<int>(frac_part.size());
+template <typename Task>
+void RunStep(double share, Task& task) {
+    const ProgressStep step(share);
+    task();
+}
 
-    return BigNumber::FromParts(std::move(digits), scale, neg);
+// Runs the tasks one after the other, or on the pool when `parallel` and
+// one is available; only the latter pays for type erasure.
+template <typename... Tasks>
+void ForkJoin(bool parallel, double share, Tasks&&... tasks) {
+    if (!parallel || !g_current_pool) {
+        (RunStep(share, tasks), ...);
+        return;
+    }
+    const std::function<void()> erased[] = {std::function<void()>(std::ref(tasks))...};
+    ForkJoinOnPool(share, erased, sizeof...(Tasks));
 }
 
-void BigNumber::StripLeadingZeros(std::string& s) {
-    size_t i = 0;
-    while (i + 1 < s.size() && s[i] == '0')
-        ++i;
-    if (i > 0)
-        s.erase(0, i);
+// Calls body(begin, end) over [0, count), in slices of at least
+// kMinParallelSlice spread over the pool when `parallel`.
+constexpr size_t kMinParallelSlice = size_t{1} << 14;
+
+template <typename Body>
+void ParallelFor(bool parallel, size_t count, const Body& body) {
+    ThreadPool* pool = g_current_pool;
+    const size_t slices = (parallel && pool)
+        ? std::min(count / kMinParallelSlice, 4 * (pool->Size() + 1))
+        : 1;
+    if (slices < 2) {
+        body(size_t{0}, count);
+        return;
+    }
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(slices);
+    for (size_t i = 0; i < slices; ++i) {
+        const size_t begin = count * i / slices;
+        const size_t end = count * (i + 1) / slices;
+        tasks.push_back([&body, begin, end] { body(begin, end); });
+    }
+    ForkJoinOnPool(0.0, tasks.data(), tasks.size());
 }
 
-void BigNumber::Normalize() {
-    if (digits_.empty())
-        digits_ = "0";
+void StripLeadingZeros(Limbs& a) {
+    while (!a.empty() && a.back() == 0)
+        a.pop_back();
+}
 
-    StripLeadingZeros(digits_);
-    if (digits_.empty())
-        digits_ = "0";
+Limbs LimbsFromRange(const Limb* a, size_t n) {
+    Limbs out(a, a + n);
+    StripLeadingZeros(out);
+    return out;
+}
 
-    while (scale_ > 0 && digits_.size() > 1 && digits_.back() == '0') {
-        digits_.pop_back();
-        --scale_;
+void MulSmallInPlace(Limbs& a, Limb m) {
+    if (a.empty())
+        return;
+    if (m == 0) {
+        a.clear();
+        return;
+    }
+    std::uint64_t carry = 0;
+    for (Limb& limb : a) {
+        const std::uint64_t cur = static_cast<std::uint64_t>(limb) * m + carry;
+        limb = static_cast<Limb>(cur % kBase);
+        carry = cur / kBase;
+    }
+    if (carry > 0)
+        a.push_back(static_cast<Limb>(carry));
+}
+
+Limb DivSmallInPlace(Limbs& a, Limb d) {
+    std::uint64_t rem = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        const std::uint64_t cur = a[i] + rem * kBase;
+        a[i] = static_cast<Limb>(cur / d);
+        rem = cur % d;
+    }
+    StripLeadingZeros(a);
+    return static_cast<Limb>(rem);
+}
+
+void ShiftLeftDecimal(Limbs& a, int digits) {
+    if (a.empty() || digits <= 0)
+        return;
+    MulSmallInPlace(a, kPow10[digits % kBaseDigits]);
+    a.insert(a.begin(), static_cast<size_t>(digits / kBaseDigits), 0);
+}
+
+void ShiftRightDecimal(Limbs& a, int digits) {
+    if (a.empty() || digits <= 0)
+        return;
+    const size_t whole = static_cast<size_t>(digits / kBaseDigits);
+    if (whole >= a.size()) {
+        a.clear();
+        return;
     }
+    a.erase(a.begin(), a.begin() + static_cast<std::ptrdiff_t>(whole));
+    DivSmallInPlace(a, kPow10[digits % kBaseDigits]);
+}
 
-    if (scale_ > 0) {
-        int integer_digits = static_cast<int>(digits_.size()) - scale_;
-        if (integer_digits <= 0) {
-            int zeros_to_add = -integer_digits + 1;
-            digits_.insert(0, static_cast<size_t>(zeros_to_add), '0');
+int CountTrailingDecimalZeros(const Limbs& a) {
+    int zeros = 0;
+    for (Limb limb : a) {
+        if (limb == 0) {
+            zeros += kBaseDigits;
+            continue;
+        }
+        while (limb % 10 == 0) {
+            limb /= 10;
+            ++zeros;
         }
+        break;
     }
+    return zeros;
+}
 
-    if (digits_ == "0") {
-        negative_ = false;
-        scale_ = 0;
+int CountDecimalDigits(const Limbs& a) {
+    if (a.empty())
+        return 0;
+    return static_cast<int>(a.size() - 1) * kBaseDigits + DecimalDigits(a.back());
+}
+
+// Drops the `drop` lowest decimal digits of a, rounding what is left by mode.
+// `sticky` reports nonzero digits below a itself.
+void RoundOffDigits(Limbs& a, int drop, bool sticky,
+                    BigNumber::RoundingMode mode, bool negative) {
+    if (drop <= 0)
+        return;
+
+    const size_t top = static_cast<size_t>((drop - 1) / kBaseDigits);
+    const int pos = (drop - 1) % kBaseDigits;
+    Limb digit = 0;
+    bool rest = sticky;
+    if (top < a.size()) {
+        digit = a[top] / kPow10[pos] % 10;
+        rest = rest || (a[top] % kPow10[pos] != 0);
     }
+    for (size_t i = 0; !rest && i < top && i < a.size(); ++i)
+        rest = (a[i] != 0);
+
+    ShiftRightDecimal(a, drop);
+
+    bool up = false;
+    switch (mode) {
+    case BigNumber::RoundingMode::kHalfEven:
+        up = digit > 5 || (digit == 5 && (rest || (!a.empty() && a[0] % 2 != 0)));
+        break;
+    case BigNumber::RoundingMode::kHalfUp:
+        up = digit >= 5;
+        break;
+    case BigNumber::RoundingMode::kTruncate:
+        break;
+    case BigNumber::RoundingMode::kFloor:
+        up = negative && (digit != 0 || rest);
+        break;
+    case BigNumber::RoundingMode::kCeiling:
+        up = !negative && (digit != 0 || rest);
+        break;
+    }
+    if (!up)
+        return;
+
+    for (Limb& limb : a) {
+        if (++limb < kBase)
+            return;
+        limb = 0;
+    }
+    a.push_back(1);
 }
 
-QString BigNumber::ToQString() const {
-    std::string s = ToStdString();
-    return QString::fromStdString(s);
+// Limb kernels behind addition, subtraction and schoolbook multiplication,
+// in a scalar version and, on x86, SSE4.1 and AVX2 versions picked once by
+// what the CPU supports.
+struct LimbKernels {
+    // out[i] = a[i] + b[i] for i < n, plus the incoming carry; returns the
+    // outgoing carry. out may be a or b.
+    Limb (*add)(Limb* out, const Limb* a, const Limb* b, size_t n, Limb carry);
+    // out[i] = a[i] - b[i] for i < n, minus the incoming borrow; returns the
+    // outgoing borrow. out may be a or b.
+    Limb (*sub)(Limb* out, const Limb* a, const Limb* b, size_t n, Limb borrow);
+    // acc[i] += m * b[i] for i < n, without carrying.
+    void (*mul_add)(std::uint64_t* acc, const Limb* b, size_t n, Limb m);
+};
+
+Limb AddLimbsScalar(Limb* out, const Limb* a, const Limb* b, size_t n, Limb carry) {
+    for (size_t i = 0; i < n; ++i) {
+        const Limb sum = a[i] + b[i] + carry;
+        carry = (sum >= kBase) ? 1 : 0;
+        out[i] = carry ? sum - kBase : sum;
+    }
+    return carry;
 }
 
-std::string BigNumber::ToStdString() const {
-    std::string out;
-    out.reserve(digits_.size() + 2);
+Limb SubLimbsScalar(Limb* out, const Limb* a, const Limb* b, size_t n, Limb borrow) {
+    for (size_t i = 0; i < n; ++i) {
+        const Limb sub = b[i] + borrow;
+        borrow = (a[i] < sub) ? 1 : 0;
+        out[i] = borrow ? a[i] + kBase - sub : a[i] - sub;
+    }
+    return borrow;
+}
+
+void MulAddScalar(std::uint64_t* acc, const Limb* b, size_t n, Limb m) {
+    for (size_t i = 0; i < n; ++i)
+        acc[i] += static_cast<std::uint64_t>(m) * b[i];
+}
 
-    if (negative_ && digits_ != "0")
-        out.push_back('-');
+#if defined(SECRETCALC_X86_SIMD)
 
-    if (scale_ == 0) {
-        out += digits_;
-        return out;
+// The vector kernels sum every lane on its own and then settle the carries
+// of a whole vector at once, as a carry-lookahead adder does. A lane
+// generates a carry when its sum is kBase or more and passes an incoming
+// one on when its sum is exactly kBase - 1; with one bit per lane, a single
+// integer addition of those masks yields the carry into every lane (bit i)
+// and out of the vector (bit `lanes`).
+inline unsigned LaneCarries(unsigned generate, unsigned propagate, unsigned carry_in) {
+    return ((generate | propagate) + generate + carry_in) ^ propagate;
+}
+
+// Limb sums and differences stay inside (-2^31, 2^31), so the signed 32-bit
+// compares below are exact.
+
+__attribute__((target("sse4.1")))
+Limb AddLimbsSse41(Limb* out, const Limb* a, const Limb* b, size_t n, Limb carry) {
+    const __m128i top = _mm_set1_epi32(kBase - 1);
+    const __m128i base = _mm_set1_epi32(kBase);
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i sum = _mm_add_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        const unsigned generate = static_cast<unsigned>(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(sum, top))));
+        const unsigned propagate = static_cast<unsigned>(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(sum, top))));
+        const unsigned carries = LaneCarries(generate, propagate, carry);
+        carry = carries >> 4;
+        const __m128i carry_in = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32(static_cast<int>(carries)), lane_bits), lane_bits);
+        __m128i r = _mm_sub_epi32(sum, carry_in);
+        r = _mm_sub_epi32(r, _mm_and_si128(_mm_cmpgt_epi32(r, top), base));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), r);
     }
+    return AddLimbsScalar(out + i, a + i, b + i, n - i, carry);
+}
 
-    const int n = static_cast<int>(digits_.size());
-    const int split = n - scale_;
+__attribute__((target("sse4.1")))
+Limb SubLimbsSse41(Limb* out, const Limb* a, const Limb* b, size_t n, Limb borrow) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i base = _mm_set1_epi32(kBase);
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i diff = _mm_sub_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        const unsigned generate = static_cast<unsigned>(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(zero, diff))));
+        const unsigned propagate = static_cast<unsigned>(
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diff, zero))));
+        const unsigned borrows = LaneCarries(generate, propagate, borrow);
+        borrow = borrows >> 4;
+        const __m128i borrow_in = _mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32(static_cast<int>(borrows)), lane_bits), lane_bits);
+        __m128i r = _mm_add_epi32(diff, borrow_in);
+        r = _mm_add_epi32(r, _mm_and_si128(_mm_cmpgt_epi32(zero, r), base));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), r);
+    }
+    return SubLimbsScalar(out + i, a + i, b + i, n - i, borrow);
+}
 
-    if (split <= 0) {
-        out += "0.";
-        out.append(static_cast<size_t>(-split), '0');
-        out += digits_;
-        return out;
+__attribute__((target("sse4.1")))
+void MulAddSse41(std::uint64_t* acc, const Limb* b, size_t n, Limb m) {
+    const __m128i factor = _mm_set1_epi64x(m);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const __m128i bv = _mm_cvtepu32_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i* dst = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(dst, _mm_add_epi64(_mm_loadu_si128(dst), _mm_mul_epu32(bv, factor)));
     }
+    MulAddScalar(acc + i, b + i, n - i, m);
+}
 
-    out.append(digits_.begin(), digits_.begin() + split);
-    out.push_back('.');
-    out.append(digits_.begin() + split, digits_.end());
+__attribute__((target("avx2")))
+Limb AddLimbsAvx2(Limb* out, const Limb* a, const Limb* b, size_t n, Limb carry) {
+    const __m256i top = _mm256_set1_epi32(kBase - 1);
+    const __m256i base = _mm256_set1_epi32(kBase);
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i sum = _mm256_add_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        const unsigned generate = static_cast<unsigned>(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(sum, top))));
+        const unsigned propagate = static_cast<unsigned>(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(sum, top))));
+        const unsigned carries = LaneCarries(generate, propagate, carry);
+        carry = carries >> 8;
+        const __m256i carry_in = _mm256_cmpeq_epi32(
+            _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(carries)), lane_bits),
+            lane_bits);
+        __m256i r = _mm256_sub_epi32(sum, carry_in);
+        r = _mm256_sub_epi32(r, _mm256_and_si256(_mm256_cmpgt_epi32(r, top), base));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+    }
+    return AddLimbsScalar(out + i, a + i, b + i, n - i, carry);
+}
 
-    while (!out.empty() && out.back() == '0' && out.find('.') != std::string::npos) {
-        out.pop_back();
+__attribute__((target("avx2")))
+Limb SubLimbsAvx2(Limb* out, const Limb* a, const Limb* b, size_t n, Limb borrow) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i base = _mm256_set1_epi32(kBase);
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i diff = _mm256_sub_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        const unsigned generate = static_cast<unsigned>(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(zero, diff))));
+        const unsigned propagate = static_cast<unsigned>(
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diff, zero))));
+        const unsigned borrows = LaneCarries(generate, propagate, borrow);
+        borrow = borrows >> 8;
+        const __m256i borrow_in = _mm256_cmpeq_epi32(
+            _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(borrows)), lane_bits),
+            lane_bits);
+        __m256i r = _mm256_add_epi32(diff, borrow_in);
+        r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_cmpgt_epi32(zero, r), base));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
     }
-    if (!out.empty() && out.back() == '.') {
-        out.pop_back();
+    return SubLimbsScalar(out + i, a + i, b + i, n - i, borrow);
+}
+
+__attribute__((target("avx2")))
+void MulAddAvx2(std::uint64_t* acc, const Limb* b, size_t n, Limb m) {
+    const __m256i factor = _mm256_set1_epi64x(m);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i bv = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m256i* dst = reinterpret_cast<__m256i*>(acc + i);
+        _mm256_storeu_si256(
+            dst, _mm256_add_epi64(_mm256_loadu_si256(dst), _mm256_mul_epu32(bv, factor)));
     }
+    MulAddScalar(acc + i, b + i, n - i, m);
+}
 
-    return out;
+#endif // SECRETCALC_X86_SIMD
+
+LimbKernels SelectLimbKernels() {
+#if defined(SECRETCALC_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {AddLimbsAvx2, SubLimbsAvx2, MulAddAvx2};
+    if (__builtin_cpu_supports("sse4.1"))
+        return {AddLimbsSse41, SubLimbsSse41, MulAddSse41};
+#endif
+    return {AddLimbsScalar, SubLimbsScalar, MulAddScalar};
 }
 
-bool BigNumber::IsZero() const {
-    return digits_ == "0";
+const LimbKernels& Kernels() {
+    static const LimbKernels kernels = SelectLimbKernels();
+    return kernels;
 }
 
-bool BigNumber::IsNegative() const {
-    return negative_ && !IsZero();
+// Adds `carry` to a[0..n) into out; returns the carry out of the top limb.
+// In place it stops as soon as the carry is absorbed.
+Limb PropagateCarry(Limb* out, const Limb* a, size_t n, Limb carry) {
+    size_t i = 0;
+    for (; i < n && carry; ++i) {
+        carry = (a[i] == kBase - 1) ? 1 : 0;
+        out[i] = carry ? 0 : a[i] + 1;
+    }
+    if (out != a)
+        std::copy(a + i, a + n, out + i);
+    return carry;
+}
+
+// Subtracts `borrow` from a[0..n) into out; returns the borrow out of the
+// top limb.
+Limb PropagateBorrow(Limb* out, const Limb* a, size_t n, Limb borrow) {
+    size_t i = 0;
+    for (; i < n && borrow; ++i) {
+        borrow = (a[i] == 0) ? 1 : 0;
+        out[i] = borrow ? kBase - 1 : a[i] - 1;
+    }
+    if (out != a)
+        std::copy(a + i, a + n, out + i);
+    return borrow;
 }
 
-int BigNumber::CompareAbsIntStrings(const std::string& a, const std::string& b) {
-    std::string aa = a, bb = b;
-    StripLeadingZeros(aa);
-    StripLeadingZeros(bb);
-    return CompareIntStrings(aa, bb);
+int CompareAbs(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size())
+        return (a.size() < b.size()) ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i])
+            return (a[i] < b[i]) ? -1 : 1;
+    }
+    return 0;
 }
 
-std::string BigNumber::AddAbsIntStrings(const std::string& a, const std::string& b) {
-    int i = static_cast<int>(a.size()) - 1;
-    int j = static_cast<int>(b.size()) - 1;
-    int carry = 0;
-    std::string out;
-    out.reserve(std::max(a.size(), b.size()) + 1);
-    while (i >= 0 || j >= 0 || carry) {
-        int sum = carry;
-        if (i >= 0) sum += (a[i--] - '0');
-        if (j >= 0) sum += (b[j--] - '0');
-        out.push_back(static_cast<char>('0' + (sum % 10)));
-        carry = sum / 10;
+Limbs AddAbs(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    if (na < nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
     }
-    std::reverse(out.begin(), out.end());
+    Limbs out(na + 1);
+    const Limb carry = Kernels().add(out.data(), a, b, nb, 0);
+    out[na] = PropagateCarry(out.data() + nb, a + nb, na - nb, carry);
     StripLeadingZeros(out);
     return out;
 }
 
-std::string BigNumber::SubAbsIntStrings(const std::string& a, const std::string& b) {
-    // a >= b
-    int i = static_cast<int>(a.size()) - 1;
-    int j = static_cast<int>(b.size()) - 1;
-    int borrow = 0;
-    std::string out;
-    out.reserve(a.size());
-    while (i >= 0) {
-        int diff = (a[i] - '0') - borrow - (j >= 0 ? (b[j] - '0') : 0);
-        if (diff < 0) {
-            diff += 10;
-            borrow = 1;
-        } else {
-            borrow = 0;
+Limbs AddAbs(const Limbs& a, const Limbs& b) {
+    return AddAbs(a.data(), a.size(), b.data(), b.size());
+}
+
+Limbs SubAbs(const Limbs& a, const Limbs& b) {
+    // a >= b, so any limbs of b past the end of a are zero.
+    const size_t nb = std::min(a.size(), b.size());
+    Limbs out(a.size());
+    const Limb borrow = Kernels().sub(out.data(), a.data(), b.data(), nb, 0);
+    PropagateBorrow(out.data() + nb, a.data() + nb, a.size() - nb, borrow);
+    StripLeadingZeros(out);
+    return out;
+}
+
+// acc -= b, where acc >= b.
+void SubInPlace(Limbs& acc, const Limbs& b) {
+    const size_t nb = std::min(acc.size(), b.size());
+    const Limb borrow = Kernels().sub(acc.data(), acc.data(), b.data(), nb, 0);
+    PropagateBorrow(acc.data() + nb, acc.data() + nb, acc.size() - nb, borrow);
+    StripLeadingZeros(acc);
+}
+
+// Compares a * 10^a_shift with b * 10^b_shift.
+int CompareAlignedAbs(const Limb* a, size_t na, int a_shift,
+                      const Limb* b, size_t nb, int b_shift) {
+    if (na == 0 || nb == 0)
+        return (na == 0 ? 0 : 1) - (nb == 0 ? 0 : 1);
+
+    const long long a_digits = static_cast<long long>(na - 1) * kBaseDigits +
+                               DecimalDigits(a[na - 1]) + a_shift;
+    const long long b_digits = static_cast<long long>(nb - 1) * kBaseDigits +
+                               DecimalDigits(b[nb - 1]) + b_shift;
+    if (a_digits != b_digits)
+        return (a_digits < b_digits) ? -1 : 1;
+
+    const size_t limbs = static_cast<size_t>((a_digits + kBaseDigits - 1) / kBaseDigits);
+    for (size_t i = limbs; i-- > 0;) {
+        const Limb x = ShiftedLimb(a, na, a_shift, i);
+        const Limb y = ShiftedLimb(b, nb, b_shift, i);
+        if (x != y)
+            return (x < y) ? -1 : 1;
+    }
+    return 0;
+}
+
+// acc += x * kBase^shift.
+void AddShiftedInPlace(Limbs& acc, const Limb* x, size_t nx, size_t shift) {
+    if (nx == 0)
+        return;
+    if (acc.size() < shift + nx)
+        acc.resize(shift + nx, 0);
+    Limb* const dst = acc.data() + shift;
+    Limb carry = Kernels().add(dst, dst, x, nx, 0);
+    carry = PropagateCarry(dst + nx, dst + nx, acc.size() - shift - nx, carry);
+    if (carry)
+        acc.push_back(carry);
+}
+
+void AddShiftedInPlace(Limbs& acc, const Limbs& x, size_t shift) {
+    AddShiftedInPlace(acc, x.data(), x.size(), shift);
+}
+
+// acc -= x * kBase^shift, where acc >= x * kBase^shift.
+void SubShiftedInPlace(Limbs& acc, const Limb* x, size_t nx, size_t shift) {
+    Limb* const dst = acc.data() + shift;
+    const Limb borrow = Kernels().sub(dst, dst, x, nx, 0);
+    PropagateBorrow(dst + nx, dst + nx, acc.size() - shift - nx, borrow);
+    StripLeadingZeros(acc);
+}
+
+// acc = x * kBase^shift - acc, where x * kBase^shift > acc.
+void ReverseSubShiftedInPlace(Limbs& acc, const Limb* x, size_t nx, size_t shift) {
+    acc.resize(shift + nx, 0);
+    // Below the shift x has only zeros: the result is the complement of acc,
+    // and a borrow leaves unless acc is zero there too.
+    Limb borrow = 0;
+    for (size_t i = 0; i < shift; ++i) {
+        const Limb sub = acc[i] + borrow;
+        borrow = (sub > 0) ? 1 : 0;
+        acc[i] = borrow ? kBase - sub : 0;
+    }
+    Kernels().sub(acc.data() + shift, x, acc.data() + shift, nx, borrow);
+    StripLeadingZeros(acc);
+}
+
+// Signed acc += signed x * 10^shift.
+void AccumulateAligned(Limbs& acc, bool& acc_negative, const Limb* x, size_t nx,
+                       int shift, bool x_negative) {
+    // Shift x by the leftover digits once, so the kernels see whole limbs.
+    Limbs shifted;
+    if (shift % kBaseDigits != 0) {
+        shifted.assign(x, x + nx);
+        MulSmallInPlace(shifted, kPow10[shift % kBaseDigits]);
+        x = shifted.data();
+        nx = shifted.size();
+    }
+    const size_t limb_shift = static_cast<size_t>(shift / kBaseDigits);
+
+    if (acc.empty())
+        acc_negative = x_negative;
+    if (acc_negative == x_negative) {
+        AddShiftedInPlace(acc, x, nx, limb_shift);
+        StripLeadingZeros(acc);
+    } else if (CompareAlignedAbs(acc.data(), acc.size(), 0, x, nx,
+                                 static_cast<int>(limb_shift) * kBaseDigits) >= 0) {
+        SubShiftedInPlace(acc, x, nx, limb_shift);
+    } else {
+        ReverseSubShiftedInPlace(acc, x, nx, limb_shift);
+        acc_negative = x_negative;
+    }
+}
+
+Limbs MulDispatch(const Limb* a, size_t na, const Limb* b, size_t nb);
+
+// Rows are summed into 64-bit columns without carrying, which lets the
+// kernel vectorize them, and the carries are settled once per kLazyRows
+// rows: kLazyRows * (kBase - 1)^2 plus a settled limb stays below 2^64.
+constexpr size_t kLazyRows = 16;
+
+Limbs MulSchoolbook(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    const LimbKernels& kernels = Kernels();
+    std::vector<std::uint64_t> columns(na + nb, 0);
+    for (size_t i = 0; i < na; ++i) {
+        if (i % 1024 == 1023)
+            Checkpoint(static_cast<double>(i) / na);
+        if (a[i] != 0)
+            kernels.mul_add(columns.data() + i, b, nb, a[i]);
+        if (i % kLazyRows != kLazyRows - 1 && i != na - 1)
+            continue;
+
+        // Columns below this block's first row are final already, and the
+        // rows so far sum to less than kBase^(i + 1 + nb), so the carry
+        // ends inside column i + nb.
+        std::uint64_t carry = 0;
+        for (size_t k = i - i % kLazyRows; k <= i + nb; ++k) {
+            const std::uint64_t cur = columns[k] + carry;
+            columns[k] = cur % kBase;
+            carry = cur / kBase;
         }
-        out.push_back(static_cast<char>('0' + diff));
-        --i;
-        --j;
     }
-    std::reverse(out.begin(), out.end());
+    Limbs out(columns.begin(), columns.end());
     StripLeadingZeros(out);
     return out;
 }
 
-std::string BigNumber::MulAbsIntStrings(const std::string& a, const std::string& b) {
-    if (a == "0" || b == "0")
-        return "0";
-    std::vector<int> tmp(a.size() + b.size(), 0);
-    for (int i = static_cast<int>(a.size()) - 1; i >= 0; --i) {
-        for (int j = static_cast<int>(b.size()) - 1; j >= 0; --j) {
-            tmp[static_cast<size_t>(i + j + 1)] += (a[i] - '0') * (b[j] - '0');
-        }
+// Requires na >= nb and 2 * nb > na.
+Limbs MulKaratsuba(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    const size_t h = (na + 1) / 2;
+    const size_t nb0 = std::min(h, nb);
+    const size_t nb1 = nb - nb0;
+
+    const Limbs sa = AddAbs(a, h, a + h, na - h);
+    const Limbs sb = AddAbs(b, nb0, b + h, nb1);
+    Limbs z0, z1, z2;
+    ForkJoin(RunsInParallel(nb), 1.0 / 3,
+        [&] { z0 = MulDispatch(a, h, b, nb0); },
+        [&] { z2 = MulDispatch(a + h, na - h, b + h, nb1); },
+        [&] { z1 = MulDispatch(sa.data(), sa.size(), sb.data(), sb.size()); });
+    SubInPlace(z1, z0);
+    SubInPlace(z1, z2);
+
+    Limbs out = std::move(z0);
+    out.reserve(na + nb);
+    AddShiftedInPlace(out, z1, h);
+    AddShiftedInPlace(out, z2, 2 * h);
+    StripLeadingZeros(out);
+    return out;
+}
+
+struct SignedLimbs {
+    Limbs mag;
+    bool neg = false;
+};
+
+SignedLimbs SignedAdd(const SignedLimbs& x, const SignedLimbs& y) {
+    SignedLimbs out;
+    if (x.neg == y.neg) {
+        out.mag = AddAbs(x.mag, y.mag);
+        out.neg = x.neg;
+    } else if (CompareAbs(x.mag, y.mag) >= 0) {
+        out.mag = SubAbs(x.mag, y.mag);
+        out.neg = x.neg;
+    } else {
+        out.mag = SubAbs(y.mag, x.mag);
+        out.neg = y.neg;
     }
-    for (int k = static_cast<int>(tmp.size()) - 1; k > 0; --k) {
-        tmp[static_cast<size_t>(k - 1)] += tmp[static_cast<size_t>(k)] / 10;
-        tmp[static_cast<size_t>(k)] %= 10;
-    }
-    std::string out;
-    out.reserve(tmp.size());
-    size_t start = 0;
-    while (start + 1 < tmp.size() && tmp[start] == 0)
-        ++start;
-    for (size_t i = start; i < tmp.size(); ++i)
-        out.push_back(static_cast<char>('0' + tmp[i]));
+    out.neg = out.neg && !out.mag.empty();
+    return out;
+}
+
+SignedLimbs SignedSub(const SignedLimbs& x, SignedLimbs y) {
+    y.neg = !y.neg && !y.mag.empty();
+    return SignedAdd(x, y);
+}
+
+SignedLimbs SignedMul(const SignedLimbs& x, const SignedLimbs& y) {
+    SignedLimbs out;
+    out.mag = MulDispatch(x.mag.data(), x.mag.size(), y.mag.data(), y.mag.size());
+    out.neg = (x.neg != y.neg) && !out.mag.empty();
+    return out;
+}
+
+void SignedDivExact(SignedLimbs& x, Limb d) {
+    DivSmallInPlace(x.mag, d);
+    x.neg = x.neg && !x.mag.empty();
+}
+
+// Toom-Cook 3 evaluated at 0, 1, -1, -2 and infinity, interpolated with
+// Bodrato's sequence. Requires na >= nb and nb > 2 * ceil(na / 3).
+Limbs MulToom3(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    const size_t k = (na + 2) / 3;
+
+    const SignedLimbs a0{LimbsFromRange(a, k)};
+    const SignedLimbs a1{LimbsFromRange(a + k, k)};
+    const SignedLimbs a2{LimbsFromRange(a + 2 * k, na - 2 * k)};
+    const SignedLimbs b0{LimbsFromRange(b, k)};
+    const SignedLimbs b1{LimbsFromRange(b + k, k)};
+    const SignedLimbs b2{LimbsFromRange(b + 2 * k, nb - 2 * k)};
+
+    const auto evaluate = [](const SignedLimbs& c0, const SignedLimbs& c1,
+                             const SignedLimbs& c2, SignedLimbs* p1,
+                             SignedLimbs* pm1, SignedLimbs* pm2) {
+        const SignedLimbs t = SignedAdd(c0, c2);
+        *p1 = SignedAdd(t, c1);
+        *pm1 = SignedSub(t, c1);
+        *pm2 = SignedAdd(*pm1, c2);
+        MulSmallInPlace(pm2->mag, 2);
+        *pm2 = SignedSub(*pm2, c0);
+    };
+
+    SignedLimbs pa1, pam1, pam2, pb1, pbm1, pbm2;
+    evaluate(a0, a1, a2, &pa1, &pam1, &pam2);
+    evaluate(b0, b1, b2, &pb1, &pbm1, &pbm2);
+
+    // Five products, each a fifth of the work.
+    SignedLimbs r0, r1, rm1, rm2, rinf;
+    ForkJoin(RunsInParallel(nb), 1.0 / 5,
+        [&] { r0 = SignedMul(a0, b0); },
+        [&] { r1 = SignedMul(pa1, pb1); },
+        [&] { rm1 = SignedMul(pam1, pbm1); },
+        [&] { rm2 = SignedMul(pam2, pbm2); },
+        [&] { rinf = SignedMul(a2, b2); });
+
+    SignedLimbs r3 = SignedSub(rm2, r1);
+    SignedDivExact(r3, 3);
+    r1 = SignedSub(r1, rm1);
+    SignedDivExact(r1, 2);
+    SignedLimbs r2 = SignedSub(rm1, r0);
+    r3 = SignedSub(r2, r3);
+    SignedDivExact(r3, 2);
+    SignedLimbs twice_rinf = rinf;
+    MulSmallInPlace(twice_rinf.mag, 2);
+    r3 = SignedAdd(r3, twice_rinf);
+    r2 = SignedSub(SignedAdd(r2, r1), rinf);
+    r1 = SignedSub(r1, r3);
+
+    Limbs out = r0.mag;
+    out.reserve(na + nb);
+    AddShiftedInPlace(out, r1.mag, k);
+    AddShiftedInPlace(out, r2.mag, 2 * k);
+    AddShiftedInPlace(out, r3.mag, 3 * k);
+    AddShiftedInPlace(out, rinf.mag, 4 * k);
     StripLeadingZeros(out);
     return out;
 }
 
-void BigNumber::AlignScales(BigNumber& a, BigNumber& b) {
-    if (a.scale_ == b.scale_)
-        return;
-    int max_scale = std::max(a.scale_, b.scale_);
+#if defined(__SIZEOF_INT128__)
+
+// Three-prime number-theoretic transform. Every prime is c * 2^k + 1 with
+// primitive root 3, and their product (~7.9e25) exceeds the largest
+// convolution coefficient n * (kBase - 1)^2 for any length the first prime
+// can transform, so the CRT recombination is exact.
+struct NttPrime {
+    std::uint32_t mod;
+    std::uint32_t root;
+};
+
+constexpr NttPrime kNttPrimes[3] = {
+    {998244353, 3},  // 119 * 2^23 + 1
+    {167772161, 3},  // 5 * 2^25 + 1
+    {469762049, 3},  // 7 * 2^26 + 1
+};
+
+constexpr size_t kNttMaxLength = size_t{1} << 23;
+
+std::uint32_t PowMod(std::uint64_t base, std::uint64_t exp, std::uint32_t mod) {
+    std::uint64_t result = 1;
+    base %= mod;
+    while (exp > 0) {
+        if (exp & 1)
+            result = result * base % mod;
+        base = base * base % mod;
+        exp >>= 1;
+    }
+    return static_cast<std::uint32_t>(result);
+}
 
-    if (a.scale_ < max_scale) {
-        int diff = max_scale - a.scale_;
-        a.digits_.append(static_cast<size_t>(diff), '0');
-        a.scale_ = max_scale;
+void Ntt(std::vector<std::uint32_t>& a, const NttPrime& prime, bool inverse, bool parallel) {
+    const size_t n = a.size();
+    const std::uint32_t mod = prime.mod;
+
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
     }
 
-    if (b.scale_ < max_scale) {
-        int diff = max_scale - b.scale_;
-        b.digits_.append(static_cast<size_t>(diff), '0');
-        b.scale_ = max_scale;
+    std::vector<std::uint32_t> roots(n / 2);
+    size_t stages = 0;
+    for (size_t len = 2; len <= n; len <<= 1)
+        ++stages;
+    size_t stage = 0;
+    for (size_t len = 2; len <= n; len <<= 1) {
+        Checkpoint(static_cast<double>(stage++) / stages);
+        std::uint32_t w = PowMod(prime.root, (mod - 1) / len, mod);
+        if (inverse)
+            w = PowMod(w, mod - 2, mod);
+        const size_t half = len / 2;
+        // Each slice of the table starts from its own power of w.
+        ParallelFor(parallel, half, [&](size_t begin, size_t end) {
+            std::uint64_t root = PowMod(w, begin, mod);
+            for (size_t k = begin; k < end; ++k) {
+                roots[k] = static_cast<std::uint32_t>(root);
+                root = root * w % mod;
+            }
+        });
+
+        // The n / 2 butterflies of a stage are independent; butterfly t
+        // is number t % half of block t / half.
+        ParallelFor(parallel, n / 2, [&](size_t begin, size_t end) {
+            size_t k = begin % half;
+            size_t i = (begin - k) * 2;
+            for (size_t t = begin; t < end; ++t) {
+                const std::uint32_t u = a[i + k];
+                const std::uint32_t v = static_cast<std::uint32_t>(
+                    static_cast<std::uint64_t>(a[i + k + half]) * roots[k] % mod);
+                a[i + k] = (u + v >= mod) ? u + v - mod : u + v;
+                a[i + k + half] = (u >= v) ? u - v : u + mod - v;
+                if (++k == half) {
+                    k = 0;
+                    i += len;
+                }
+            }
+        });
     }
 
-    if (a.digits_.empty()) a.digits_ = "0";
-    if (b.digits_.empty()) b.digits_ = "0";
+    if (inverse) {
+        const std::uint64_t n_inv = PowMod(n, mod - 2, mod);
+        ParallelFor(parallel, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                a[i] = static_cast<std::uint32_t>(a[i] * n_inv % mod);
+        });
+    }
 }
 
-std::pair<std::string, std::string> BigNumber::DivModAbsIntStrings(
-    const std::string& num, const std::string& den) {
+// Cyclic convolution of a and b modulo one prime, in a buffer of length n.
+std::vector<std::uint32_t> ConvolveMod(const Limb* a, size_t na,
+                                       const Limb* b, size_t nb,
+                                       size_t n, const NttPrime& prime, bool parallel) {
+    const bool square = (a == b && na == nb);
+    const double share = square ? 1.0 / 2 : 1.0 / 3;
+    std::vector<std::uint32_t> fa(n, 0);
+    for (size_t i = 0; i < na; ++i)
+        fa[i] = a[i] % prime.mod;
+
+    if (square) {
+        {
+            const ProgressStep step(share);
+            Ntt(fa, prime, false, parallel);
+        }
+        for (std::uint32_t& x : fa)
+            x = static_cast<std::uint32_t>(static_cast<std::uint64_t>(x) * x % prime.mod);
+    } else {
+        std::vector<std::uint32_t> fb(n, 0);
+        for (size_t i = 0; i < nb; ++i)
+            fb[i] = b[i] % prime.mod;
+        ForkJoin(parallel, share,
+            [&] { Ntt(fa, prime, false, parallel); },
+            [&] { Ntt(fb, prime, false, parallel); });
+        ParallelFor(parallel, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                fa[i] = static_cast<std::uint32_t>(
+                    static_cast<std::uint64_t>(fa[i]) * fb[i] % prime.mod);
+        });
+    }
 
-    if (den == "0")
-        throw std::domain_error("BigNumber: division by zero");
-    if (num == "0")
-        return {"0", "0"};
+    {
+        const ProgressStep step(share);
+        Ntt(fa, prime, true, parallel);
+    }
+    return fa;
+}
 
-    std::string d = den;
-    StripLeadingZeros(d);
-    std::string n = num;
-    StripLeadingZeros(n);
+bool NttFits(size_t na, size_t nb) {
+    return na + nb - 1 <= kNttMaxLength;
+}
 
-    if (CompareIntStrings(n, d) < 0)
-        return {"0", n};
+Limbs MulNtt(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    size_t n = 1;
+    while (n < na + nb - 1)
+        n <<= 1;
+
+    // The three primes are independent, and so are the butterflies of
+    // every transform stage.
+    const bool parallel = RunsInParallel(nb);
+    std::vector<std::uint32_t> r[3];
+    ForkJoin(parallel, 1.0 / 3,
+        [&] { r[0] = ConvolveMod(a, na, b, nb, n, kNttPrimes[0], parallel); },
+        [&] { r[1] = ConvolveMod(a, na, b, nb, n, kNttPrimes[1], parallel); },
+        [&] { r[2] = ConvolveMod(a, na, b, nb, n, kNttPrimes[2], parallel); });
+    const std::vector<std::uint32_t>& r0 = r[0];
+    const std::vector<std::uint32_t>& r1 = r[1];
+    const std::vector<std::uint32_t>& r2 = r[2];
+
+    const std::uint64_t p0 = kNttPrimes[0].mod;
+    const std::uint64_t p1 = kNttPrimes[1].mod;
+    const std::uint64_t p2 = kNttPrimes[2].mod;
+    const std::uint64_t p0_inv_mod_p1 = PowMod(p0, p1 - 2, static_cast<std::uint32_t>(p1));
+    const std::uint64_t p01_inv_mod_p2 =
+        PowMod(p0 * p1 % p2, p2 - 2, static_cast<std::uint32_t>(p2));
+
+    // Garner's mixed-radix recombination, then carry into base-10^9 limbs.
+    Limbs out(na + nb, 0);
+    unsigned __int128 carry = 0;
+    for (size_t i = 0; i < na + nb; ++i) {
+        unsigned __int128 value = carry;
+        if (i < na + nb - 1) {
+            const std::uint64_t x0 = r0[i];
+            const std::uint64_t x1 = (r1[i] + p1 - x0 % p1) % p1 * p0_inv_mod_p1 % p1;
+            const std::uint64_t partial = (x0 + p0 % p2 * x1) % p2;
+            const std::uint64_t x2 = (r2[i] + p2 - partial) % p2 * p01_inv_mod_p2 % p2;
+            value += x0 + static_cast<unsigned __int128>(p0) * x1 +
+                     static_cast<unsigned __int128>(p0 * p1) * x2;
+        }
+        out[i] = static_cast<Limb>(value % kBase);
+        carry = value / kBase;
+    }
+    StripLeadingZeros(out);
+    return out;
+}
 
-    std::string quotient;
-    quotient.reserve(n.size());
+#endif // __SIZEOF_INT128__
 
-    std::string remainder = "0";
-    for (char c : n) {
-        if (remainder != "0")
-            remainder.push_back(c);
-        else
-            remainder = std::string(1, c);
-        StripLeadingZeros(remainder);
-
-        int q_digit = 0;
-        if (CompareIntStrings(remainder, d) >= 0) {
-            int lo = 1, hi = 9;
-            while (lo <= hi) {
-                int mid = (lo + hi) / 2;
-                std::string prod = MulIntStringByDigit(d, mid);
-                int cmp = CompareIntStrings(prod, remainder);
-                if (cmp <= 0) {
-                    q_digit = mid;
-                    lo = mid + 1;
-                } else {
-                    hi = mid - 1;
-                }
+Limbs MulDispatch(const Limb* a, size_t na, const Limb* b, size_t nb) {
+    if (na < nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    while (nb > 0 && b[nb - 1] == 0)
+        --nb;
+    while (na > 0 && a[na - 1] == 0)
+        --na;
+    if (na == 0 || nb == 0)
+        return {};
+    PollCancelled();
+    if (na < nb) {
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+
+    if (nb < Tuned(g_tuning.karatsuba_threshold))
+        return MulSchoolbook(a, na, b, nb);
+
+#if defined(__SIZEOF_INT128__)
+    if (nb >= Tuned(g_tuning.ntt_threshold) && NttFits(na, nb))
+        return MulNtt(a, na, b, nb);
+#endif
+
+    // Very unbalanced operands: multiply nb-sized slices of a and sum them,
+    // so the recursive algorithms always see roughly square problems.
+    if (na >= 2 * nb) {
+        Limbs out;
+        out.reserve(na + nb);
+        const double share = static_cast<double>(nb) / na;
+        if (RunsInParallel(nb)) {
+            // All slices are multiplied at once and summed afterwards.
+            std::vector<Limbs> parts((na + nb - 1) / nb);
+            std::vector<std::function<void()>> tasks;
+            tasks.reserve(parts.size());
+            for (size_t i = 0; i < parts.size(); ++i) {
+                tasks.push_back([&, i] {
+                    const size_t off = i * nb;
+                    parts[i] = MulDispatch(a + off, std::min(nb, na - off), b, nb);
+                });
+            }
+            ForkJoinOnPool(share, tasks.data(), tasks.size());
+            for (size_t i = 0; i < parts.size(); ++i)
+                AddShiftedInPlace(out, parts[i], i * nb);
+        } else {
+            for (size_t off = 0; off < na; off += nb) {
+                const ProgressStep step(share);
+                const Limbs part = MulDispatch(a + off, std::min(nb, na - off), b, nb);
+                AddShiftedInPlace(out, part, off);
             }
-            remainder = SubAbsIntStrings(remainder, MulIntStringByDigit(d, q_digit));
         }
-        quotient.push_back(static_cast<char>('0' + q_digit));
+        StripLeadingZeros(out);
+        return out;
     }
+
+    if (nb >= Tuned(g_tuning.toom3_threshold) && nb > 2 * ((na + 2) / 3))
+        return MulToom3(a, na, b, nb);
+    return MulKaratsuba(a, na, b, nb);
+}
+
+Limbs MulAbs(const Limbs& a, const Limbs& b) {
+    const ProgressStep step(1.0);
+    const ParallelScope parallel(std::min(a.size(), b.size()));
+    return MulDispatch(a.data(), a.size(), b.data(), b.size());
+}
+
+// Knuth, TAOCP vol. 2, 4.3.1, Algorithm D. Requires den.size() >= 2 and
+// num >= den.
+std::pair<Limbs, Limbs> DivModKnuth(const Limbs& num, const Limbs& den) {
+    const size_t n = den.size();
+    const size_t m = num.size() - n;
+
+    // D1: scale both operands so the divisor's top limb is at least kBase / 2.
+    const Limb scale = kBase / (den.back() + 1);
+    Limbs u = num;
+    MulSmallInPlace(u, scale);
+    u.resize(num.size() + 1, 0);
+    Limbs v = den;
+    MulSmallInPlace(v, scale);
+
+    const std::uint64_t v_top = v[n - 1];
+    const std::uint64_t v_next = v[n - 2];
+    Limbs quotient(m + 1, 0);
+
+    for (size_t j = m + 1; j-- > 0;) {
+        Checkpoint(static_cast<double>(m - j) / (m + 1));
+        // D3: estimate the quotient limb from the top two limbs.
+        const std::uint64_t top2 = static_cast<std::uint64_t>(u[j + n]) * kBase + u[j + n - 1];
+        std::uint64_t q_hat = top2 / v_top;
+        std::uint64_t r_hat = top2 % v_top;
+        while (q_hat >= kBase || q_hat * v_next > r_hat * kBase + u[j + n - 2]) {
+            --q_hat;
+            r_hat += v_top;
+            if (r_hat >= kBase)
+                break;
+        }
+
+        // D4: multiply and subtract.
+        std::uint64_t carry = 0;
+        std::int64_t borrow = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const std::uint64_t p = q_hat * v[i] + carry;
+            carry = p / kBase;
+            std::int64_t t = static_cast<std::int64_t>(u[i + j]) -
+                             static_cast<std::int64_t>(p % kBase) - borrow;
+            borrow = (t < 0) ? 1 : 0;
+            u[i + j] = static_cast<Limb>(borrow ? t + kBase : t);
+        }
+        std::int64_t top = static_cast<std::int64_t>(u[j + n]) -
+                           static_cast<std::int64_t>(carry) - borrow;
+
+        // D6: the estimate was one too large; add the divisor back.
+        if (top < 0) {
+            --q_hat;
+            Limb add_carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                Limb sum = u[i + j] + v[i] + add_carry;
+                add_carry = (sum >= kBase) ? 1 : 0;
+                u[i + j] = add_carry ? sum - kBase : sum;
+            }
+            top += add_carry;
+        }
+        u[j + n] = static_cast<Limb>(top);
+        quotient[j] = static_cast<Limb>(q_hat);
+    }
+
+    // D8: the remainder is the low part of u, unscaled.
+    u.resize(n);
+    StripLeadingZeros(u);
+    DivSmallInPlace(u, scale);
     StripLeadingZeros(quotient);
-    StripLeadingZeros(remainder);
-    return {quotient, remainder};
+    return {std::move(quotient), std::move(u)};
+}
+
+// Drops the k least significant limbs.
+void ShiftRightLimbs(Limbs& a, size_t k) {
+    if (k >= a.size()) {
+        a.clear();
+        return;
+    }
+    a.erase(a.begin(), a.begin() + static_cast<std::ptrdiff_t>(k));
+}
+
+Limbs PowerOfBase(size_t k) {
+    Limbs out(k + 1, 0);
+    out.back() = 1;
+    return out;
 }
 
-BigNumber BigNumber::DivDecimal(const BigNumber& a_in, const BigNumber& b_in,
-                                int fractional_precision) {
+// Approximates kBase^(m + k) / d, where d has m limbs, to within a few
+// units. Each Newton step doubles the number of correct limbs:
+// x' = x + x * (kBase^(m + k) - d * x) / kBase^(m + k).
+Limbs ApproxReciprocal(const Limbs& d, size_t k) {
+    const size_t m = d.size();
 
-    if (b_in.IsZero())
+    // At k limbs of precision only the top k + 2 limbs of d matter.
+    if (m > k + 2) {
+        const Limbs top(d.end() - static_cast<std::ptrdiff_t>(k + 2), d.end());
+        return ApproxReciprocal(top, k);
+    }
+
+    if (k <= Tuned(g_tuning.newton_div_threshold)) {
+        Limbs pow = PowerOfBase(m + k);
+        if (m == 1) {
+            DivSmallInPlace(pow, d[0]);
+            return pow;
+        }
+        return DivModKnuth(pow, d).first;
+    }
+
+    // The recursion works at half the precision, so the three steps cost
+    // about the same.
+    const size_t h = k / 2 + 1;
+    Limbs x;
+    {
+        const ProgressStep step(1.0 / 3);
+        x = ApproxReciprocal(d, h);
+    }
+
+    // e = kBase^(m + h) - d * x is small; its sign decides the direction.
+    Limbs dx;
+    {
+        const ProgressStep step(1.0 / 3);
+        dx = MulAbs(d, x);
+    }
+    const Limbs pow = PowerOfBase(m + h);
+    const bool over = CompareAbs(dx, pow) > 0;
+    const Limbs e = over ? SubAbs(dx, pow) : SubAbs(pow, dx);
+
+    Limbs correction;
+    {
+        const ProgressStep step(1.0 / 3);
+        correction = MulAbs(x, e);
+    }
+    ShiftRightLimbs(correction, m + 2 * h - k);
+
+    Limbs out(k - h, 0);
+    out.insert(out.end(), x.begin(), x.end());
+    if (over)
+        SubInPlace(out, correction);
+    else
+        AddShiftedInPlace(out, correction, 0);
+    return out;
+}
+
+// Division through a Newton reciprocal, so the cost follows multiplication.
+// Requires num >= den.
+std::pair<Limbs, Limbs> DivModNewton(const Limbs& num, const Limbs& den) {
+    const size_t m = den.size();
+    const size_t quotient_limbs = num.size() - m + 1;
+
+    Limbs reciprocal;
+    {
+        const ProgressStep step(1.0 / 2);
+        reciprocal = ApproxReciprocal(den, quotient_limbs);
+    }
+    Limbs quotient;
+    {
+        const ProgressStep step(1.0 / 4);
+        quotient = MulAbs(num, reciprocal);
+    }
+    ShiftRightLimbs(quotient, m + quotient_limbs);
+
+    // The estimate is within a couple of units; fix it up exactly.
+    Limbs product;
+    {
+        const ProgressStep step(1.0 / 4);
+        product = MulAbs(quotient, den);
+    }
+    const Limbs one{1};
+    while (CompareAbs(product, num) > 0) {
+        SubInPlace(quotient, one);
+        SubInPlace(product, den);
+    }
+    Limbs remainder = SubAbs(num, product);
+    while (CompareAbs(remainder, den) >= 0) {
+        AddShiftedInPlace(quotient, one, 0);
+        SubInPlace(remainder, den);
+    }
+    return {std::move(quotient), std::move(remainder)};
+}
+
+std::pair<Limbs, Limbs> DivModAbs(const Limbs& num, const Limbs& den) {
+    const ProgressStep step(1.0);
+    if (den.empty())
         throw std::domain_error("BigNumber: division by zero");
+    if (num.empty())
+        return {{}, {}};
 
-    BigNumber a = a_in;
-    BigNumber b = b_in;
-    a.negative_ = false;
-    b.negative_ = false;
-    const int shift = b.scale_ - a.scale_;
+    if (CompareAbs(num, den) < 0)
+        return {{}, num};
 
-    std::string numerator = a.digits_;
-    if (shift > 0) {
-        numerator.append(static_cast<size_t>(shift), '0');
+    if (den.size() == 1) {
+        Limbs q = num;
+        const Limb r = DivSmallInPlace(q, den[0]);
+        return {std::move(q), r ? Limbs{r} : Limbs{}};
     }
 
-    numerator.append(static_cast<size_t>(fractional_precision), '0');
-    auto [q, /*r*/ _] = DivModAbsIntStrings(numerator, b.digits_);
+    const size_t quotient_limbs = num.size() - den.size() + 1;
+    if (den.size() <= Tuned(g_tuning.newton_div_threshold) ||
+        quotient_limbs <= Tuned(g_tuning.newton_div_threshold))
+        return DivModKnuth(num, den);
+    return DivModNewton(num, den);
+}
+
+// Binary GCD (Stein); both arguments nonzero.
+template <typename Magnitude>
+Magnitude BinaryGcd(Magnitude a, Magnitude b) {
+    const auto trailing_zero_bits = [](Magnitude v) {
+        int n = 0;
+        if constexpr (sizeof(Magnitude) > sizeof(std::uint64_t)) {
+            while (static_cast<std::uint64_t>(v) == 0) {
+                v >>= 64;
+                n += 64;
+            }
+        }
+        std::uint64_t low = static_cast<std::uint64_t>(v);
+        while ((low & 1) == 0) {
+            low >>= 1;
+            ++n;
+        }
+        return n;
+    };
+
+    const int shift = trailing_zero_bits(a | b);
+    a >>= trailing_zero_bits(a);
+    while (b != 0) {
+        b >>= trailing_zero_bits(b);
+        if (a > b)
+            std::swap(a, b);
+        b -= a;
+    }
+    return a << shift;
+}
 
-    int out_scale = fractional_precision;
-    if (shift < 0) {
-        out_scale += (-shift);
+// Lehmer steps run on the leading kLehmerDigits digits, which fit in int64
+// along with the cofactors they produce.
+constexpr int kLehmerDigits = 18;
+
+// floor(a / 10^drop), for a result below 10^kLehmerDigits.
+std::int64_t LeadingDigits(const Limbs& a, int drop) {
+    const size_t w = static_cast<size_t>(drop / kBaseDigits);
+    const int part = drop % kBaseDigits;
+    std::uint64_t v = 0;
+    std::uint64_t weight = 1;
+    for (size_t i = w; i < a.size() && i < w + 3; ++i) {
+        const Limb limb = (i == w) ? a[i] / kPow10[part] : a[i];
+        v += limb * weight;
+        weight *= (i == w) ? kPow10[kBaseDigits - part] : kBase;
     }
+    return static_cast<std::int64_t>(v);
+}
 
-    return BigNumber::FromParts(std::move(q), out_scale, false);
+Limbs LimbsFromU64(std::uint64_t v) {
+    Limbs out;
+    while (v > 0) {
+        out.push_back(static_cast<Limb>(v % kBase));
+        v /= kBase;
+    }
+    return out;
 }
 
-BigNumber BigNumber::operator+(const BigNumber& rhs) const {
-    BigNumber a = *this;
-    BigNumber b = rhs;
-    AlignScales(a, b);
+// x * a + y * b for cofactors of opposite sign whose result is non-negative.
+Limbs CombineAbs(const Limbs& a, std::int64_t x, const Limbs& b, std::int64_t y) {
+    const auto magnitude = [](std::int64_t v) {
+        return LimbsFromU64(static_cast<std::uint64_t>(v < 0 ? -v : v));
+    };
+    const Limbs xa = MulAbs(a, magnitude(x));
+    const Limbs yb = MulAbs(b, magnitude(y));
+    return (x >= 0 && y <= 0) ? SubAbs(xa, yb) : SubAbs(yb, xa);
+}
+
+// Lehmer's GCD (Knuth, TAOCP vol. 2, 4.5.2, Algorithm L): Euclid steps are
+// simulated on leading digits and applied to the full numbers in one
+// linear combination, so each round removes about kLehmerDigits / 2 digits
+// at the cost of a few single-limb multiplications.
+Limbs GcdAbs(Limbs a, Limbs b) {
+    const ProgressStep step(1.0);
+    if (CompareAbs(a, b) < 0)
+        std::swap(a, b);
+
+    // b shrinks by about the same number of digits every round.
+    const double initial_size = static_cast<double>(b.size());
+    while (b.size() > 2) {
+        Checkpoint(1.0 - b.size() / initial_size);
+        // The steps below are too small to report on their own.
+        const ProgressStep round(0.0);
+        const int drop = CountDecimalDigits(a) - kLehmerDigits;
+        std::int64_t ah = LeadingDigits(a, drop);
+        std::int64_t bh = LeadingDigits(b, drop);
+
+        std::int64_t x0 = 1, y0 = 0, x1 = 0, y1 = 1;
+        while (bh + x1 > 0 && bh + y1 > 0) {
+            const std::int64_t q = (ah + x0) / (bh + x1);
+            if (q != (ah + y0) / (bh + y1))
+                break;
+            std::int64_t t = x0 - q * x1;
+            x0 = x1;
+            x1 = t;
+            t = y0 - q * y1;
+            y0 = y1;
+            y1 = t;
+            t = ah - q * bh;
+            ah = bh;
+            bh = t;
+        }
+
+        if (y0 == 0) {
+            // The leading digits decided nothing: take one full step.
+            Limbs r = DivModAbs(a, b).second;
+            a = std::move(b);
+            b = std::move(r);
+        } else {
+            Limbs na = CombineAbs(a, x0, b, y0);
+            Limbs nb = CombineAbs(a, x1, b, y1);
+            a = std::move(na);
+            b = std::move(nb);
+        }
+    }
+
+    if (b.empty())
+        return a;
+    const Limbs r = DivModAbs(a, b).second;
+    if (r.empty())
+        return b;
 
-    if (a.negative_ == b.negative_) {
-        BigNumber out = FromParts(AddAbsIntStrings(a.digits_, b.digits_),
-                                  a.scale_, a.negative_);
+    const auto to_u64 = [](const Limbs& v) {
+        std::uint64_t out = 0;
+        for (size_t i = v.size(); i-- > 0;)
+            out = out * kBase + v[i];
         return out;
+    };
+    return LimbsFromU64(BinaryGcd(to_u64(b), to_u64(r)));
+}
+
+// Divides the positive integer n by the highest power of factor that divides
+// it and returns the exponent. Squares of factor are tried upwards until one
+// no longer divides, then each smaller one once on the way down, so a power
+// k costs O(log k) divisions rather than k.
+int RemoveFactor(BigNumber* n, const BigNumber& factor) {
+    std::vector<BigNumber> powers{factor};
+    int count = 0;
+    for (;;) {
+        if (*n < powers.back())
+            break;
+        auto [quotient, remainder] = BigNumber::DivMod(*n, powers.back());
+        if (!remainder.IsZero())
+            break;
+        *n = std::move(quotient);
+        count += 1 << (powers.size() - 1);
+        BigNumber square = powers.back() * powers.back();
+        powers.push_back(std::move(square));
+    }
+    powers.pop_back();
+    while (!powers.empty()) {
+        if (*n >= powers.back()) {
+            auto [quotient, remainder] = BigNumber::DivMod(*n, powers.back());
+            if (remainder.IsZero()) {
+                *n = std::move(quotient);
+                count += 1 << (powers.size() - 1);
+            }
+        }
+        powers.pop_back();
     }
+    return count;
+}
+
+} // namespace
+
+BigNumber::BigNumber() : scale_(0), negative_(false) {}
+
+BigNumber::BigNumber(std::string_view s) : BigNumber(Parse(s)) {}
+
+BigNumber::Tuning BigNumber::GetTuning() {
+    Tuning tuning;
+    tuning.karatsuba_threshold = Tuned(g_tuning.karatsuba_threshold);
+    tuning.toom3_threshold = Tuned(g_tuning.toom3_threshold);
+    tuning.ntt_threshold = Tuned(g_tuning.ntt_threshold);
+    tuning.newton_div_threshold = Tuned(g_tuning.newton_div_threshold);
+    tuning.parallel_threshold = Tuned(g_tuning.parallel_threshold);
+    tuning.threads = Tuned(g_tuning.threads);
+    return tuning;
+}
+
+void BigNumber::SetTuning(const Tuning& tuning) {
+    // Karatsuba splits in halves and Toom-3 in thirds; smaller cut-offs
+    // would recurse without shrinking the problem.
+    g_tuning.karatsuba_threshold.store(
+        std::max<std::size_t>(tuning.karatsuba_threshold, 2), std::memory_order_relaxed);
+    g_tuning.toom3_threshold.store(
+        std::max<std::size_t>(tuning.toom3_threshold, 3), std::memory_order_relaxed);
+    g_tuning.ntt_threshold.store(
+        std::max<std::size_t>(tuning.ntt_threshold, 1), std::memory_order_relaxed);
+    g_tuning.newton_div_threshold.store(
+        std::max<std::size_t>(tuning.newton_div_threshold, 4), std::memory_order_relaxed);
+    g_tuning.parallel_threshold.store(
+        std::max<std::size_t>(tuning.parallel_threshold, 1), std::memory_order_relaxed);
+    // Later multiplications create a pool of the new size.
+    const std::lock_guard<std::mutex> lock(g_pool_mutex);
+    if (g_tuning.threads.exchange(tuning.threads, std::memory_order_relaxed) != tuning.threads)
+        g_pool.reset();
+}
+
+BigNumber::Context BigNumber::GetContext() {
+    return g_context;
+}
+
+void BigNumber::SetContext(const Context& context) {
+    g_context = context;
+    g_context.digits = std::max(g_context.digits, 1);
+}
+
+BigNumber::ScopedContext::ScopedContext(const Context& context)
+    : saved_(GetContext()) {
+    SetContext(context);
+}
+
+BigNumber::ScopedContext::~ScopedContext() {
+    SetContext(saved_);
+}
+
+BigNumber::ScopedControl::ScopedControl(const ComputeControl* control)
+    : saved_(g_control) {
+    g_control = control;
+}
 
-    int cmp = CompareAbsIntStrings(a.digits_, b.digits_);
-    if (cmp == 0)
-        return BigNumber::Zero();
-    if (cmp > 0) {
-        return FromParts(SubAbsIntStrings(a.digits_, b.digits_),
-                         a.scale_, a.negative_);
+BigNumber::ScopedControl::~ScopedControl() {
+    g_control = saved_;
+}
+
+BigNumber BigNumber::Zero() {
+    return BigNumber();
+}
+
+BigNumber BigNumber::One() {
+    return BigNumber::FromSmall(1, 0, false);
+}
+
+BigNumber BigNumber::Pow10(int exponent) {
+    if (exponent > kMaxScale || exponent < -kMaxScale)
+        throw std::overflow_error("BigNumber: exponent out of range");
+    return BigNumber::FromSmall(1, -exponent, false);
+}
+
+#if defined(__SIZEOF_INT128__)
+bool BigNumber::ToScaledInteger(int scale, int digits, __int128* out) const {
+    if (!IsSmall())
+        return false;
+    Small magnitude = small_;
+    if (magnitude != 0) {
+        // The magnitude has no trailing zeros, so it can only grow.
+        const long long shift = static_cast<long long>(scale) - scale_;
+        if (shift < 0 || shift >= kSmallDigits ||
+            !ScaleSmall(magnitude, static_cast<int>(shift)))
+            return false;
     }
-    return FromParts(SubAbsIntStrings(b.digits_, a.digits_),
-                     a.scale_, b.negative_);
+    if (magnitude >= Pow10Small(std::min(digits, kSmallDigits)))
+        return false;
+    *out = negative_ ? -static_cast<__int128>(magnitude) : static_cast<__int128>(magnitude);
+    return true;
 }
 
-BigNumber BigNumber::operator-(const BigNumber& rhs) const {
-    BigNumber neg_rhs = rhs;
-    if (!neg_rhs.IsZero())
-        neg_rhs.negative_ = !neg_rhs.negative_;
-    return (*this) + neg_rhs;
+BigNumber BigNumber::FromScaledInteger(__int128 value, int scale) {
+    const bool negative = value < 0;
+    const Small magnitude = negative ? Small(0) - static_cast<Small>(value)
+                                     : static_cast<Small>(value);
+    return FromSmall(magnitude, scale, negative);
 }
+#endif
 
-BigNumber BigNumber::operator*(const BigNumber& rhs) const {
-    BigNumber a = *this;
-    BigNumber b = rhs;
-    const bool neg = (a.IsNegative() != b.IsNegative());
-    a.negative_ = false;
-    b.negative_ = false;
+BigNumber BigNumber::FromParts(Limbs limbs, int scale, bool negative) {
+    BigNumber n;
+    n.limbs_ = std::move(limbs);
+    n.scale_ = scale;
+    n.negative_ = negative;
+    n.Normalize();
+    return n;
+}
+
+BigNumber BigNumber::FromSmall(Small magnitude, int scale, bool negative) {
+    BigNumber n;
+    if (magnitude >= Pow10Small(kSmallDigits)) {
+        n.limbs_ = LimbsFromSmall(magnitude);
+    } else {
+        n.small_ = magnitude;
+    }
+    n.scale_ = scale;
+    n.negative_ = negative;
+    n.Normalize();
+    return n;
+}
 
-    std::string prod = MulAbsIntStrings(a.digits_, b.digits_);
-    const int scale = a.scale_ + b.scale_;
-    return FromParts(std::move(prod), scale, neg);
+BigNumber::Small BigNumber::Pow10Small(int k) {
+    static constexpr auto kTable = [] {
+        std::array<Small, kSmallDigits + 1> t{};
+        t[0] = 1;
+        for (size_t i = 1; i < t.size(); ++i)
+            t[i] = t[i - 1] * 10;
+        return t;
+    }();
+    return kTable[static_cast<size_t>(k)];
 }
 
-BigNumber BigNumber::operator/(const BigNumber& rhs) const {
+// magnitude *= 10^digits, unless the result would leave the inline range.
+bool BigNumber::ScaleSmall(Small& magnitude, int digits) {
+    if (magnitude == 0 || digits == 0)
+        return true;
+    if (digits >= kSmallDigits || magnitude >= Pow10Small(kSmallDigits - digits))
+        return false;
+    magnitude *= Pow10Small(digits);
+    return true;
+}
+
+BigNumber::Limbs BigNumber::LimbsFromSmall(Small magnitude) {
+    Limbs out;
+    while (magnitude > 0) {
+        out.push_back(static_cast<Limb>(magnitude % kBase));
+        magnitude /= kBase;
+    }
+    return out;
+}
+
+// Moves an inline magnitude into limbs_ so the limb kernels can work on it.
+// The result is not canonical; it is only used for intermediate values.
+void BigNumber::Promote() {
+    if (!IsSmall())
+        return;
+    limbs_ = LimbsFromSmall(small_);
+    small_ = 0;
+}
+
+const BigNumber::Limbs& BigNumber::MagnitudeLimbs(Limbs& scratch) const {
+    if (!IsSmall())
+        return limbs_;
+    scratch = LimbsFromSmall(small_);
+    return scratch;
+}
+
+bool BigNumber::AddSmall(const BigNumber& a, const BigNumber& b, bool negate_b,
+                         BigNumber* out) {
+    const int scale = std::max(a.scale_, b.scale_);
+    Small am = a.small_;
+    Small bm = b.small_;
+    if (!ScaleSmall(am, scale - a.scale_) || !ScaleSmall(bm, scale - b.scale_))
+        return false;
+
+    // Both magnitudes are below 10^kSmallDigits, so the sum cannot wrap.
+    const bool b_negative = (b.negative_ != negate_b);
+    if (a.negative_ == b_negative)
+        *out = FromSmall(am + bm, scale, a.negative_);
+    else if (am >= bm)
+        *out = FromSmall(am - bm, scale, a.negative_);
+    else
+        *out = FromSmall(bm - am, scale, b_negative);
+    return true;
+}
+
+bool BigNumber::MulSmall(const BigNumber& a, const BigNumber& b, BigNumber* out) {
+    Small prod = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    if (__builtin_mul_overflow(a.small_, b.small_, &prod))
+        return false;
+#else
+    if (b.small_ != 0 && a.small_ > std::numeric_limits<Small>::max() / b.small_)
+        return false;
+    prod = a.small_ * b.small_;
+#endif
+    *out = FromSmall(prod, a.scale_ + b.scale_, a.negative_ != b.negative_);
+    return true;
+}
+
+BigNumber BigNumber::Parse(std::string_view s) {
+    if (s.empty())
+        throw std::invalid_argument("BigNumber: empty string");
+
+    bool neg = false;
+    size_t pos = 0;
+    if (s[0] == '+') {
+        pos = 1;
+    } else if (s[0] == '-') {
+        neg = true;
+        pos = 1;
+    }
+
+    if (pos >= s.size())
+        throw std::invalid_argument("BigNumber: sign without digits");
+
+    const size_t int_begin = pos;
+    pos = SkipDigits(s, pos);
+    std::string_view int_part = s.substr(int_begin, pos - int_begin);
+
+    std::string_view frac_part;
+    if (pos < s.size() && s[pos] == '.') {
+        const size_t frac_begin = ++pos;
+        pos = SkipDigits(s, pos);
+        frac_part = s.substr(frac_begin, pos - frac_begin);
+    }
+
+    long long exponent = 0;
+    if (pos < s.size()) {
+        // Whitespace is allowed anywhere but hardly ever present, so the
+        // text is only copied without it once the scan runs into some.
+        constexpr std::string_view kSpace = " \t\n\v\f\r";
+        if (s.find_first_of(kSpace, pos) != std::string_view::npos) {
+            std::string stripped;
+            stripped.reserve(s.size());
+            for (char c : s) {
+                if (kSpace.find(c) == std::string_view::npos)
+                    stripped.push_back(c);
+            }
+            return Parse(stripped);
+        }
+        if (s[pos] == 'e' || s[pos] == 'E')
+            exponent = ParseExponent(s, pos + 1);
+        else if (s[pos] == '.')
+            throw std::invalid_argument("BigNumber: multiple dots");
+        else
+            throw std::invalid_argument("BigNumber: invalid char");
+    }
+
+    if (int_part.empty() && frac_part.empty())
+        throw std::invalid_argument("BigNumber: no digits");
+
+    while (!frac_part.empty() && frac_part.back() == '0')
+        frac_part.remove_suffix(1);
+    const long long scale = static_cast<long long>(frac_part.size()) - exponent;
+    if (scale > kMaxScale || scale < -kMaxScale)
+        throw std::invalid_argument("BigNumber: exponent out of range");
+
+    // Leading zeros carry no magnitude; the scale above already counts them.
+    while (!int_part.empty() && int_part.front() == '0')
+        int_part.remove_prefix(1);
+    if (int_part.empty()) {
+        while (!frac_part.empty() && frac_part.front() == '0')
+            frac_part.remove_prefix(1);
+    }
+
+    if (int_part.size() + frac_part.size() <= static_cast<size_t>(kSmallDigits)) {
+        Small magnitude = 0;
+        Small weight = 1;
+        ForEachLimb(int_part, frac_part, [&](Limb limb) {
+            magnitude += weight * limb;
+            weight *= kBase;
+        });
+        return FromSmall(magnitude, static_cast<int>(scale), neg);
+    }
+    return FromParts(LimbsFromDigits(int_part, frac_part), static_cast<int>(scale), neg);
+}
+
+void BigNumber::Normalize() {
+    if (IsSmall()) {
+        while (small_ != 0 && small_ % 10 == 0) {
+            small_ /= 10;
+            --scale_;
+        }
+    } else {
+        StripLeadingZeros(limbs_);
+
+        if (!limbs_.empty()) {
+            const int strip = CountTrailingDecimalZeros(limbs_);
+            ShiftRightDecimal(limbs_, strip);
+            scale_ -= strip;
+        }
+
+        if (limbs_.size() <= static_cast<size_t>(kSmallDigits / kBaseDigits)) {
+            small_ = 0;
+            for (size_t i = limbs_.size(); i-- > 0;)
+                small_ = small_ * kBase + limbs_[i];
+            limbs_ = Limbs();
+        }
+    }
+
+    if (IsZero()) {
+        negative_ = false;
+        scale_ = 0;
+    } else if (scale_ > kMaxScale || scale_ < -kMaxScale) {
+        throw std::overflow_error("BigNumber: exponent out of range");
+    }
+}
+
+std::string BigNumber::ToStdString() const {
+    Limb small_buf[kSmallDigits / kBaseDigits];
+    const Limb* limbs = nullptr;
+    const size_t count = MagnitudeView(small_buf, &limbs);
+
+    // The leading limb is printed without padding, the others as
+    // kBaseDigits digits each.
+    char lead[kBaseDigits] = {'0'};
+    const size_t lead_size = (count == 0)
+        ? 1
+        : static_cast<size_t>(std::to_chars(lead, lead + kBaseDigits, limbs[count - 1]).ptr - lead);
+    const size_t digits = lead_size + (count == 0 ? 0 : count - 1) * kBaseDigits;
+
+    // The text is sized up front and filled with '0', so the zeros between
+    // the point and the digits, or after the digits, are already there.
+    constexpr size_t kNoPoint = std::numeric_limits<size_t>::max();
+    size_t point = kNoPoint;
+    size_t zeros_before = 0;
+    size_t zeros_after = 0;
+    if (scale_ <= 0) {
+        if (!IsZero())
+            zeros_after = static_cast<size_t>(-scale_);
+    } else if (static_cast<long long>(digits) <= scale_) {
+        zeros_before = static_cast<size_t>(scale_) - digits;
+    } else {
+        point = digits - static_cast<size_t>(scale_);
+    }
+    const bool leading_point = (scale_ > 0 && point == kNoPoint);
+
+    std::string out((IsNegative() ? 1 : 0) + (leading_point ? 2 + zeros_before : 0) + digits +
+                        (point != kNoPoint ? 1 : 0) + zeros_after,
+                    '0');
+    char* p = out.data();
+    if (IsNegative())
+        *p++ = '-';
+    if (leading_point) {
+        p[1] = '.';
+        p += 2 + zeros_before;
+    }
+
+    size_t written = 0;
+    const auto put = [&](const char* src, size_t n) {
+        if (point > written && point < written + n) {
+            const size_t head = point - written;
+            std::memcpy(p, src, head);
+            p[head] = '.';
+            std::memcpy(p + head + 1, src + head, n - head);
+            p += n + 1;
+        } else {
+            if (point == written)
+                *p++ = '.';
+            std::memcpy(p, src, n);
+            p += n;
+        }
+        written += n;
+    };
+    put(lead, lead_size);
+    char buf[kBaseDigits];
+    for (size_t i = (count > 0 ? count - 1 : 0); i-- > 0;) {
+        WriteLimbDigits(limbs[i], buf);
+        put(buf, kBaseDigits);
+    }
+    return out;
+}
+
+bool BigNumber::IsZero() const {
+    return IsSmall() && small_ == 0;
+}
+
+bool BigNumber::IsNegative() const {
+    return negative_ && !IsZero();
+}
+
+bool BigNumber::IsInteger() const {
+    return scale_ <= 0;
+}
+
+bool BigNumber::IsPowerOfTen() const {
+    return IsSmall() && small_ == 1 && !negative_;
+}
+
+int BigNumber::FractionalDigits() const {
+    return std::max(scale_, 0);
+}
+
+int BigNumber::SignificantDigits() const {
+    if (!IsSmall())
+        return CountDecimalDigits(limbs_);
+    int digits = 0;
+    for (Small m = small_; m > 0; m /= 10)
+        ++digits;
+    return digits;
+}
+
+BigNumber BigNumber::Divide(const BigNumber& rhs, const Context& context) const {
     if (rhs.IsZero())
         throw std::domain_error("BigNumber: division by zero");
+    if (IsZero())
+        return BigNumber();
+
+    const int digits = std::max(context.digits, 1);
+    const bool neg = (IsNegative() != rhs.IsNegative());
+
+    Limbs a_scratch, b_scratch;
+    Limbs numerator = MagnitudeLimbs(a_scratch);
+    Limbs denominator = rhs.MagnitudeLimbs(b_scratch);
+
+    // A / B >= 10^(lead - 1), so scaling it by 10^(digits + 1 - lead) gives
+    // an integer quotient of digits + 1 or digits + 2 digits: at least one
+    // guard digit, with the remainder deciding anything below it.
+    const int lead = CountDecimalDigits(numerator) - CountDecimalDigits(denominator);
+    const long long shift = static_cast<long long>(digits) + 1 - lead;
+    if (shift >= 0)
+        ShiftLeftDecimal(numerator, static_cast<int>(shift));
+    else
+        ShiftLeftDecimal(denominator, static_cast<int>(-shift));
+
+    auto [q, r] = DivModAbs(numerator, denominator);
+    const bool inexact = std::any_of(r.begin(), r.end(), [](Limb v) { return v != 0; });
+    const int drop = CountDecimalDigits(q) - digits;
+    RoundOffDigits(q, drop, inexact, context.rounding, neg);
+
+    const long long scale = shift + scale_ - rhs.scale_ - drop;
+    if (scale > std::numeric_limits<int>::max() || scale < std::numeric_limits<int>::min())
+        throw std::overflow_error("BigNumber: exponent out of range");
+    return FromParts(std::move(q), static_cast<int>(scale), neg);
+}
+
+BigNumber BigNumber::Round(const Context& context) const {
+    Limbs scratch;
+    const Limbs& magnitude = MagnitudeLimbs(scratch);
+    const int drop = CountDecimalDigits(magnitude) - std::max(context.digits, 1);
+    if (drop <= 0)
+        return *this;
+
+    Limbs rounded = magnitude;
+    RoundOffDigits(rounded, drop, false, context.rounding, IsNegative());
+    return FromParts(std::move(rounded), scale_ - drop, negative_);
+}
 
-    const bool neg = (this->IsNegative() != rhs.IsNegative());
-    BigNumber q = DivDecimal(*this, rhs, kDefaultDivPrecision);
-    q.negative_ = neg && !q.IsZero();
-    q.Normalize();
-    return q;
+// Scale at which both integers' magnitudes line up without fractional
+// digits; never positive.
+int BigNumber::CommonIntegerScale(const BigNumber& a, const BigNumber& b) {
+    if (!a.IsInteger() || !b.IsInteger())
+        throw std::invalid_argument("BigNumber: integer operation on a fraction");
+    return std::max(a.scale_, b.scale_);
+}
+
+std::pair<BigNumber, BigNumber> BigNumber::DivMod(const BigNumber& a, const BigNumber& b) {
+    const int scale = CommonIntegerScale(a, b);
+    if (b.IsZero())
+        throw std::domain_error("BigNumber: division by zero");
+
+    const bool q_negative = (a.negative_ != b.negative_);
+    Small am = a.small_;
+    Small bm = b.small_;
+    if (a.IsSmall() && b.IsSmall() &&
+        ScaleSmall(am, scale - a.scale_) && ScaleSmall(bm, scale - b.scale_)) {
+        return {FromSmall(am / bm, 0, q_negative),
+                FromSmall(am % bm, scale, a.negative_)};
+    }
+
+    Limbs a_scratch, b_scratch;
+    Limbs num = a.MagnitudeLimbs(a_scratch);
+    Limbs den = b.MagnitudeLimbs(b_scratch);
+    ShiftLeftDecimal(num, scale - a.scale_);
+    ShiftLeftDecimal(den, scale - b.scale_);
+    auto [q, r] = DivModAbs(num, den);
+    return {FromParts(std::move(q), 0, q_negative),
+            FromParts(std::move(r), scale, a.negative_)};
+}
+
+BigNumber BigNumber::Gcd(const BigNumber& a, const BigNumber& b) {
+    const int scale = CommonIntegerScale(a, b);
+    if (a.IsZero() || b.IsZero()) {
+        BigNumber out = a.IsZero() ? b : a;
+        out.negative_ = false;
+        return out;
+    }
+
+    Small am = a.small_;
+    Small bm = b.small_;
+    if (a.IsSmall() && b.IsSmall() &&
+        ScaleSmall(am, scale - a.scale_) && ScaleSmall(bm, scale - b.scale_))
+        return FromSmall(BinaryGcd(am, bm), scale, false);
+
+    Limbs a_scratch, b_scratch;
+    Limbs am_limbs = a.MagnitudeLimbs(a_scratch);
+    Limbs bm_limbs = b.MagnitudeLimbs(b_scratch);
+    ShiftLeftDecimal(am_limbs, scale - a.scale_);
+    ShiftLeftDecimal(bm_limbs, scale - b.scale_);
+    return FromParts(GcdAbs(std::move(am_limbs), std::move(bm_limbs)), scale, false);
+}
+
+bool BigNumber::DivideExactly(const BigNumber& a, const BigNumber& b, int max_digits,
+                              BigNumber* quotient) {
+    if (b.IsZero())
+        throw std::domain_error("BigNumber: division by zero");
+    if (a.IsZero()) {
+        *quotient = BigNumber();
+        return true;
+    }
+
+    // With A and B the magnitudes read as integers, a / b is A / B moved by
+    // the difference of the scales. Trailing zeros of B live in its scale,
+    // so B is 2^k * d or 5^k * d with d free of that prime, and A / B
+    // terminates exactly when d divides A. Then A / B = (A / d) * r^k / 10^k
+    // with r the other prime.
+    BigNumber dividend = a;
+    BigNumber divisor = b;
+    dividend.scale_ = divisor.scale_ = 0;
+    dividend.negative_ = divisor.negative_ = false;
+    const Limb last_digit = static_cast<Limb>(divisor.IsSmall() ? divisor.small_ % 10
+                                                                 : divisor.limbs_[0] % 10);
+    const bool even = (last_digit % 2 == 0);
+    int k = 0;
+    if (even || last_digit == 5)
+        k = RemoveFactor(&divisor, FromSmall(even ? 2 : 5, 0, false));
+    if (divisor != One()) {
+        if (dividend < divisor)
+            return false;
+        auto [q, r] = DivMod(dividend, divisor);
+        if (!r.IsZero())
+            return false;
+        dividend = std::move(q);
+    }
+
+    // r^k has more than k * log10(r) digits, of which trailing zeros can
+    // cancel at most log2(A / d) < 4 * SignificantDigits(A / d), so past
+    // this bound the quotient cannot fit and r^k is never built.
+    const double log10_r = even ? 0.69897 : 0.30103;
+    if (k * log10_r > static_cast<double>(max_digits) + 4.0 * dividend.SignificantDigits() + 1)
+        return false;
+    BigNumber power = One();
+    BigNumber base = FromSmall(even ? 5 : 2, 0, false);
+    for (int e = k; e > 0; e >>= 1) {
+        if (e & 1)
+            power *= base;
+        if (e > 1)
+            base *= base;
+    }
+    dividend *= power;
+    if (dividend.SignificantDigits() > max_digits)
+        return false;
+
+    const long long scale = static_cast<long long>(a.scale_) - b.scale_ + k;
+    if (scale > kMaxScale || scale < -kMaxScale)
+        throw std::overflow_error("BigNumber: exponent out of range");
+    dividend *= Pow10(-static_cast<int>(scale));
+    if (a.negative_ != b.negative_)
+        dividend.Negate();
+    *quotient = std::move(dividend);
+    return true;
+}
+
+void BigNumber::AddInPlace(const BigNumber& rhs, bool negate_rhs) {
+    if (IsSmall() && rhs.IsSmall() && AddSmall(*this, rhs, negate_rhs, this))
+        return;
+    if (rhs.IsZero())
+        return;
+    if (&rhs == this) {
+        const BigNumber copy = rhs;
+        AddInPlace(copy, negate_rhs);
+        return;
+    }
+
+    const bool rhs_negative = (rhs.negative_ != negate_rhs);
+    Limb rhs_buf[kSmallDigits / kBaseDigits];
+    const Limb* rhs_limbs = nullptr;
+    const size_t rhs_size = rhs.MagnitudeView(rhs_buf, &rhs_limbs);
+
+    if (scale_ >= rhs.scale_) {
+        // rhs lines up at a digit offset inside our own limbs.
+        Promote();
+        AccumulateAligned(limbs_, negative_, rhs_limbs, rhs_size,
+                          scale_ - rhs.scale_, rhs_negative);
+    } else {
+        // We are the operand that needs the offset; accumulate into rhs.
+        Limb own_buf[kSmallDigits / kBaseDigits];
+        const Limb* own_limbs = nullptr;
+        const size_t own_size = MagnitudeView(own_buf, &own_limbs);
+        Limbs acc(rhs_limbs, rhs_limbs + rhs_size);
+        bool acc_negative = rhs_negative;
+        AccumulateAligned(acc, acc_negative, own_limbs, own_size,
+                          rhs.scale_ - scale_, negative_);
+        limbs_ = std::move(acc);
+        small_ = 0;
+        negative_ = acc_negative;
+        scale_ = rhs.scale_;
+    }
+    Normalize();
+}
+
+BigNumber& BigNumber::operator+=(const BigNumber& rhs) {
+    AddInPlace(rhs, false);
+    return *this;
+}
+
+BigNumber& BigNumber::operator-=(const BigNumber& rhs) {
+    AddInPlace(rhs, true);
+    return *this;
+}
+
+BigNumber& BigNumber::operator*=(const BigNumber& rhs) {
+    if (IsSmall() && rhs.IsSmall() && MulSmall(*this, rhs, this))
+        return *this;
+
+    const bool neg = (IsNegative() != rhs.IsNegative());
+    Limbs a_scratch, b_scratch;
+    limbs_ = MulAbs(MagnitudeLimbs(a_scratch), rhs.MagnitudeLimbs(b_scratch));
+    small_ = 0;
+    scale_ += rhs.scale_;
+    negative_ = neg;
+    Normalize();
+    return *this;
+}
+
+BigNumber& BigNumber::operator/=(const BigNumber& rhs) {
+    *this = Divide(rhs, g_context);
+    return *this;
+}
+
+BigNumber& BigNumber::Negate() {
+    if (!IsZero())
+        negative_ = !negative_;
+    return *this;
+}
+
+BigNumber BigNumber::operator+(const BigNumber& rhs) const {
+    BigNumber out = *this;
+    out += rhs;
+    return out;
+}
+
+BigNumber BigNumber::operator-(const BigNumber& rhs) const {
+    BigNumber out = *this;
+    out -= rhs;
+    return out;
+}
+
+BigNumber BigNumber::operator*(const BigNumber& rhs) const {
+    BigNumber out = *this;
+    out *= rhs;
+    return out;
+}
+
+BigNumber BigNumber::operator/(const BigNumber& rhs) const {
+    return Divide(rhs, g_context);
 }
 
 BigNumber BigNumber::Percent() const {
-    return FromParts(digits_, scale_ + 2, negative_);
+    if (IsSmall())
+        return FromSmall(small_, scale_ + 2, negative_);
+    return FromParts(limbs_, scale_ + 2, negative_);
 }
 
 bool operator==(const BigNumber& a, const BigNumber& b) {
-    BigNumber aa = a;
-    BigNumber bb = b;
-    aa.Normalize();
-    bb.Normalize();
-    return aa.negative_ == bb.negative_ &&
-           aa.scale_ == bb.scale_ &&
-           aa.digits_ == bb.digits_;
+    // Both operands are normalized and the inline/limb choice is canonical,
+    // so equal values have identical fields.
+    return a.negative_ == b.negative_ &&
+           a.scale_ == b.scale_ &&
+           a.small_ == b.small_ &&
+           a.limbs_ == b.limbs_;
 }
 
-bool operator<(const BigNumber& a, const BigNumber& b) {
-    if (a == b)
-        return false;
-    if (a.IsNegative() != b.IsNegative())
-        return a.IsNegative();
+// Exposes the magnitude as a limb array; inline magnitudes are unpacked into
+// small_buf, which must hold kSmallDigits / kBaseDigits limbs.
+size_t BigNumber::MagnitudeView(Limb* small_buf, const Limb** data) const {
+    if (!IsSmall()) {
+        *data = limbs_.data();
+        return limbs_.size();
+    }
+    size_t n = 0;
+    for (Small m = small_; m > 0; m /= kBase)
+        small_buf[n++] = static_cast<Limb>(m % kBase);
+    *data = small_buf;
+    return n;
+}
+
+int BigNumber::CompareMagnitude(const BigNumber& a, const BigNumber& b) {
+    if (a.IsZero() || b.IsZero())
+        return (a.IsZero() ? 0 : 1) - (b.IsZero() ? 0 : 1);
+
+    const int scale = std::max(a.scale_, b.scale_);
+    if (a.IsSmall() && b.IsSmall()) {
+        Small am = a.small_;
+        Small bm = b.small_;
+        if (ScaleSmall(am, scale - a.scale_) && ScaleSmall(bm, scale - b.scale_))
+            return (am < bm) ? -1 : (am > bm) ? 1 : 0;
+    }
 
-    BigNumber aa = a;
-    BigNumber bb = b;
-    aa.negative_ = false;
-    bb.negative_ = false;
-    BigNumber::AlignScales(aa, bb);
+    Limb a_buf[kSmallDigits / kBaseDigits];
+    Limb b_buf[kSmallDigits / kBaseDigits];
+    const Limb* ad = nullptr;
+    const Limb* bd = nullptr;
+    const size_t an = a.MagnitudeView(a_buf, &ad);
+    const size_t bn = b.MagnitudeView(b_buf, &bd);
+    return CompareAlignedAbs(ad, an, scale - a.scale_, bd, bn, scale - b.scale_);
+}
+
+int BigNumber::Compare(const BigNumber& a, const BigNumber& b) {
+    const bool a_negative = a.IsNegative();
+    if (a_negative != b.IsNegative())
+        return a_negative ? -1 : 1;
+    const int magnitude = CompareMagnitude(a, b);
+    return a_negative ? -magnitude : magnitude;
+}
 
-    int cmp = BigNumber::CompareAbsIntStrings(aa.digits_, bb.digits_);
-    if (!a.IsNegative()) {
-        return cmp < 0;
+std::size_t BigNumber::Hash() const {
+    // Normalized values are canonical, so hashing the fields is consistent
+    // with operator==.
+    std::size_t h = std::hash<int>()(scale_) ^ (negative_ ? 0x5bd1e995u : 0u);
+    const auto mix = [&h](std::uint64_t v) {
+        h ^= std::hash<std::uint64_t>()(v) + 0x9e3779b9u + (h << 6) + (h >> 2);
+    };
+    if (IsSmall()) {
+        mix(static_cast<std::uint64_t>(small_));
+        mix(static_cast<std::uint64_t>(small_ >> 32 >> 32));
+    } else {
+        for (Limb limb : limbs_)
+            mix(limb);
     }
-    return cmp > 0;
+    return h;
 }
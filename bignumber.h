@@ -1,67 +1,263 @@
 #pragma once
 
-#include <QString>
-#include <string>
-#include <memory>
-
-
-#include <QString>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <utility>
+#include <vector>
 
 class BigNumber final
 {
 public:
     BigNumber();
-    explicit BigNumber(const QString& s);
-    explicit BigNumber(const std::string& s);
+    // Decimal text, optionally signed, with an optional e/E exponent. Parsed
+    // in place; only the limbs of numbers too large for inline storage are
+    // allocated.
+    explicit BigNumber(std::string_view s);
+
+    // Operand sizes, in base-10^9 limbs of the smaller factor, at which
+    // multiplication moves from schoolbook to Karatsuba, from Karatsuba to
+    // Toom-Cook 3 and from Toom-Cook 3 to the number-theoretic transform
+    // (NTT is only built where the compiler provides 128-bit integers).
+    // Division uses Knuth's Algorithm D until both the divisor and the
+    // quotient exceed newton_div_threshold limbs, then a Newton reciprocal.
+    // Multiplications whose smaller factor has at least parallel_threshold
+    // limbs run their subproducts and transform stages on `threads` threads,
+    // which large divisions inherit through their multiplications; 0 means
+    // one per hardware thread and 1 keeps everything on the calling thread.
+    // Calibrate per machine; process-wide.
+    struct Tuning {
+        std::size_t karatsuba_threshold = 40;
+        std::size_t toom3_threshold = 160;
+        std::size_t ntt_threshold = 900;
+        std::size_t newton_div_threshold = 1000;
+        std::size_t parallel_threshold = 2000;
+        std::size_t threads = 0;
+    };
+
+    static Tuning GetTuning();
+    static void SetTuning(const Tuning& tuning);
+
+    enum class RoundingMode {
+        kHalfEven,
+        kHalfUp,
+        kTruncate,
+        kFloor,
+        kCeiling
+    };
+
+    // Division rounds its quotient to `digits` significant digits; addition,
+    // subtraction and multiplication stay exact. The work done by a division
+    // grows with `digits`, not with a fixed precision.
+    struct Context {
+        int digits = 40;
+        RoundingMode rounding = RoundingMode::kHalfEven;
+    };
+
+    // Context used by operator/ and /= on the calling thread.
+    static Context GetContext();
+    static void SetContext(const Context& context);
+
+    // Installs a context on the calling thread for the lifetime of the guard.
+    class ScopedContext final {
+    public:
+        explicit ScopedContext(const Context& context);
+        ~ScopedContext();
+
+        ScopedContext(const ScopedContext&) = delete;
+        ScopedContext& operator=(const ScopedContext&) = delete;
+
+    private:
+        Context saved_;
+    };
+
+    // Lets another thread follow and stop a long computation. While a
+    // control is installed on a thread, the multiplication, division and GCD
+    // kernels publish their progress to it and poll it, throwing Cancelled
+    // once Cancel() has been called.
+    class ComputeControl final {
+    public:
+        void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+        bool IsCancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+        // Share of the running multiplication, division or GCD done so far,
+        // in [0, 1]; every such operation starts again from zero.
+        double Progress() const {
+            return progress_.load(std::memory_order_relaxed) / double(kProgressScale);
+        }
+        void SetProgress(double progress) {
+            progress = std::min(std::max(progress, 0.0), 1.0);
+            progress_.store(static_cast<std::uint32_t>(progress * kProgressScale),
+                            std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr std::uint32_t kProgressScale = 1u << 20;
+
+        std::atomic<bool> cancelled_{false};
+        std::atomic<std::uint32_t> progress_{0};
+    };
+
+    class Cancelled final : public std::runtime_error {
+    public:
+        Cancelled() : std::runtime_error("BigNumber: computation cancelled") {}
+    };
+
+    // Installs a control on the calling thread for the lifetime of the guard;
+    // nullptr turns polling off.
+    class ScopedControl final {
+    public:
+        explicit ScopedControl(const ComputeControl* control);
+        ~ScopedControl();
+
+        ScopedControl(const ScopedControl&) = delete;
+        ScopedControl& operator=(const ScopedControl&) = delete;
+
+    private:
+        const ComputeControl* saved_;
+    };
 
     static BigNumber Zero();
     static BigNumber One();
+    // 10^exponent; stored as a single digit with an exponent.
+    static BigNumber Pow10(int exponent);
+
+#if defined(__SIZEOF_INT128__)
+    // Exchange with fixed-point types. ToScaledInteger stores value * 10^scale
+    // when that is an integer of at most `digits` digits (up to 36) and
+    // returns false otherwise; FromScaledInteger is its inverse.
+    bool ToScaledInteger(int scale, int digits, __int128* out) const;
+    static BigNumber FromScaledInteger(__int128 value, int scale);
+#endif
 
-    QString ToQString() const;
     std::string ToStdString() const;
 
     bool IsZero() const;
     bool IsNegative() const;
+    bool IsInteger() const;
+    bool IsPowerOfTen() const;
+    // Digits after the decimal point in the shortest exact representation.
+    int FractionalDigits() const;
+    // Digits of the magnitude without trailing zeros; zero has none.
+    int SignificantDigits() const;
 
     BigNumber operator+(const BigNumber& rhs) const;
     BigNumber operator-(const BigNumber& rhs) const;
     BigNumber operator*(const BigNumber& rhs) const;
     BigNumber operator/(const BigNumber& rhs) const;
 
+    // In-place forms reuse the left operand's storage where the algorithm
+    // allows it; the rvalue overloads below forward to them.
+    BigNumber& operator+=(const BigNumber& rhs);
+    BigNumber& operator-=(const BigNumber& rhs);
+    BigNumber& operator*=(const BigNumber& rhs);
+    BigNumber& operator/=(const BigNumber& rhs);
+
+    BigNumber Divide(const BigNumber& rhs, const Context& context) const;
+    // Rounds to context.digits significant digits.
+    BigNumber Round(const Context& context) const;
+
+    // Integer-only operations; they throw std::invalid_argument for values
+    // with a fractional part. DivMod truncates toward zero, so the remainder
+    // takes the sign of a. Gcd is never negative.
+    static std::pair<BigNumber, BigNumber> DivMod(const BigNumber& a, const BigNumber& b);
+    static BigNumber Gcd(const BigNumber& a, const BigNumber& b);
+
+    // Sets *quotient to a / b and returns true when the quotient terminates
+    // within max_digits significant digits; otherwise returns false and
+    // leaves *quotient alone. Decides with a divisibility test instead of
+    // dividing to a precision. Throws std::domain_error when b is zero.
+    static bool DivideExactly(const BigNumber& a, const BigNumber& b, int max_digits,
+                              BigNumber* quotient);
+
+    friend BigNumber operator+(BigNumber&& a, const BigNumber& b) { a += b; return std::move(a); }
+    friend BigNumber operator+(const BigNumber& a, BigNumber&& b) { b += a; return std::move(b); }
+    friend BigNumber operator+(BigNumber&& a, BigNumber&& b) { a += b; return std::move(a); }
+    friend BigNumber operator-(BigNumber&& a, const BigNumber& b) { a -= b; return std::move(a); }
+    friend BigNumber operator-(const BigNumber& a, BigNumber&& b) { b.Negate() += a; return std::move(b); }
+    friend BigNumber operator-(BigNumber&& a, BigNumber&& b) { a -= b; return std::move(a); }
+    friend BigNumber operator*(BigNumber&& a, const BigNumber& b) { a *= b; return std::move(a); }
+    friend BigNumber operator*(const BigNumber& a, BigNumber&& b) { b *= a; return std::move(b); }
+    friend BigNumber operator*(BigNumber&& a, BigNumber&& b) { a *= b; return std::move(a); }
+    friend BigNumber operator/(BigNumber&& a, const BigNumber& b) { a /= b; return std::move(a); }
+
+    BigNumber& Negate();
+
     BigNumber Percent() const;
     BigNumber operator%(int /*percent_token*/) const { return Percent(); }
 
+    // Three-way comparison: negative, zero or positive as a <, == or > b.
+    // Works on the normalized operands in place and never allocates.
+    static int Compare(const BigNumber& a, const BigNumber& b);
+    std::size_t Hash() const;
+
     friend bool operator==(const BigNumber& a, const BigNumber& b);
     friend bool operator!=(const BigNumber& a, const BigNumber& b) { return !(a == b); }
-    friend bool operator<(const BigNumber& a, const BigNumber& b);
-    friend bool operator>(const BigNumber& a, const BigNumber& b) { return b < a; }
-    friend bool operator<=(const BigNumber& a, const BigNumber& b) { return !(b < a); }
-    friend bool operator>=(const BigNumber& a, const BigNumber& b) { return !(a < b); }
+    friend bool operator<(const BigNumber& a, const BigNumber& b) { return Compare(a, b) < 0; }
+    friend bool operator>(const BigNumber& a, const BigNumber& b) { return Compare(a, b) > 0; }
+    friend bool operator<=(const BigNumber& a, const BigNumber& b) { return Compare(a, b) <= 0; }
+    friend bool operator>=(const BigNumber& a, const BigNumber& b) { return Compare(a, b) >= 0; }
 
 private:
-    std::string digits_;
+    // Magnitude is stored as base-10^9 limbs, least significant limb first.
+    // Zero is an empty vector; the most significant limb is never zero.
+    using Limb = std::uint32_t;
+    using Limbs = std::vector<Limb>;
+
+#if defined(__SIZEOF_INT128__)
+    using Small = unsigned __int128;
+    static constexpr int kSmallDigits = 36;
+#else
+    using Small = std::uint64_t;
+    static constexpr int kSmallDigits = 18;
+#endif
+
+    // Magnitudes below 10^kSmallDigits live inline in small_ with limbs_
+    // left empty, so they never touch the heap; larger ones live in limbs_
+    // and small_ is zero. Which form is used depends only on the value.
+    Limbs limbs_;
+    Small small_ = 0;
+    // The value is magnitude * 10^-scale_. Trailing decimal zeros of the
+    // magnitude are always folded into scale_, which goes negative for
+    // large powers of ten. Results whose scale would pass 10^8 either way
+    // throw std::overflow_error.
     int scale_ = 0;
     bool negative_ = false;
 
-    static BigNumber FromParts(std::string digits, int scale, bool negative);
-    static BigNumber Parse(const std::string& s);
+    bool IsSmall() const { return limbs_.empty(); }
+
+    static BigNumber FromParts(Limbs limbs, int scale, bool negative);
+    static BigNumber FromSmall(Small magnitude, int scale, bool negative);
+    static BigNumber Parse(std::string_view s);
 
     void Normalize();
-    static void StripLeadingZeros(std::string& s);
+    void Promote();
+    const Limbs& MagnitudeLimbs(Limbs& scratch) const;
 
-    static int CompareAbsIntStrings(const std::string& a, const std::string& b);
-    static std::string AddAbsIntStrings(const std::string& a, const std::string& b);
-    static std::string SubAbsIntStrings(const std::string& a, const std::string& b);
-    static std::string MulAbsIntStrings(const std::string& a, const std::string& b);
+    static Small Pow10Small(int k);
+    static bool ScaleSmall(Small& magnitude, int digits);
+    static Limbs LimbsFromSmall(Small magnitude);
+    static bool AddSmall(const BigNumber& a, const BigNumber& b, bool negate_b,
+                         BigNumber* out);
+    static bool MulSmall(const BigNumber& a, const BigNumber& b, BigNumber* out);
+    static int CommonIntegerScale(const BigNumber& a, const BigNumber& b);
 
-    static void AlignScales(BigNumber& a, BigNumber& b);
+    void AddInPlace(const BigNumber& rhs, bool negate_rhs);
 
-    static std::pair<std::string, std::string> DivModAbsIntStrings(
-        const std::string& num, const std::string& den);
+    size_t MagnitudeView(Limb* small_buf, const Limb** data) const;
+    static int CompareMagnitude(const BigNumber& a, const BigNumber& b);
+
+};
 
-    static BigNumber DivDecimal(const BigNumber& a, const BigNumber& b,
-                                int fractional_precision);
+namespace std {
+template <>
+struct hash<BigNumber> {
+    std::size_t operator()(const BigNumber& n) const noexcept { return n.Hash(); }
 };
+} // namespace std
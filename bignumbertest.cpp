@@ -0,0 +1,728 @@
+// BigNumber against references: schoolbook arithmetic on digit strings,
+// quotients rounded in 128-bit integers, and every multiplication and
+// division algorithm against the simplest one.
+
+#include "bignumber.h"
+#include "testsupport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// --- Limb arithmetic against digit strings ---------------------------------
+
+// A signed integer as its decimal digits, without leading zeros; zero is
+// "0" and never negative.
+struct Digits {
+    bool negative = false;
+    std::string magnitude = "0";
+};
+
+int CompareMagnitudes(const std::string& a, const std::string& b) {
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+    return a.compare(b) < 0 ? -1 : (a == b ? 0 : 1);
+}
+
+std::string Trimmed(std::string digits) {
+    const std::size_t first = digits.find_first_not_of('0');
+    return first == std::string::npos ? "0" : digits.substr(first);
+}
+
+std::string AddMagnitudes(const std::string& a, const std::string& b) {
+    std::string out;
+    int carry = 0;
+    for (std::size_t i = 0; i < std::max(a.size(), b.size()) || carry; ++i) {
+        const int sum = carry + (i < a.size() ? a[a.size() - 1 - i] - '0' : 0) +
+                        (i < b.size() ? b[b.size() - 1 - i] - '0' : 0);
+        out.push_back(static_cast<char>('0' + sum % 10));
+        carry = sum / 10;
+    }
+    std::reverse(out.begin(), out.end());
+    return Trimmed(out);
+}
+
+// a - b for a >= b.
+std::string SubtractMagnitudes(const std::string& a, const std::string& b) {
+    std::string out;
+    int borrow = 0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        int digit = a[a.size() - 1 - i] - '0' - borrow -
+                    (i < b.size() ? b[b.size() - 1 - i] - '0' : 0);
+        borrow = digit < 0;
+        out.push_back(static_cast<char>('0' + digit + 10 * borrow));
+    }
+    std::reverse(out.begin(), out.end());
+    return Trimmed(out);
+}
+
+std::string MultiplyMagnitudes(const std::string& a, const std::string& b) {
+    std::vector<int> acc(a.size() + b.size(), 0);
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        for (std::size_t j = 0; j < b.size(); ++j)
+            acc[i + j + 1] += (a[i] - '0') * (b[j] - '0');
+    }
+    for (std::size_t k = acc.size(); k-- > 1;) {
+        acc[k - 1] += acc[k] / 10;
+        acc[k] %= 10;
+    }
+    std::string out;
+    for (int digit : acc)
+        out.push_back(static_cast<char>('0' + digit));
+    return Trimmed(out);
+}
+
+Digits Make(bool negative, std::string magnitude) {
+    magnitude = Trimmed(std::move(magnitude));
+    return {negative && magnitude != "0", magnitude};
+}
+
+Digits Add(const Digits& a, const Digits& b) {
+    if (a.negative == b.negative)
+        return Make(a.negative, AddMagnitudes(a.magnitude, b.magnitude));
+    if (CompareMagnitudes(a.magnitude, b.magnitude) >= 0)
+        return Make(a.negative, SubtractMagnitudes(a.magnitude, b.magnitude));
+    return Make(b.negative, SubtractMagnitudes(b.magnitude, a.magnitude));
+}
+
+Digits Negated(Digits a) {
+    return Make(!a.negative, a.magnitude);
+}
+
+Digits Multiply(const Digits& a, const Digits& b) {
+    return Make(a.negative != b.negative, MultiplyMagnitudes(a.magnitude, b.magnitude));
+}
+
+int Compare(const Digits& a, const Digits& b) {
+    if (a.negative != b.negative)
+        return a.negative ? -1 : 1;
+    const int magnitude = CompareMagnitudes(a.magnitude, b.magnitude);
+    return a.negative ? -magnitude : magnitude;
+}
+
+std::string Text(const Digits& a) {
+    return (a.negative ? "-" : "") + a.magnitude;
+}
+
+// Mostly nines and zeros, so carries and borrows run across whole limbs.
+Digits RandomOperand(std::mt19937_64& rng) {
+    const std::size_t size = 1 + rng() % 90;
+    std::string magnitude(size, '0');
+    const int style = static_cast<int>(rng() % 3);
+    for (char& c : magnitude) {
+        if (style == 0)
+            c = static_cast<char>('0' + rng() % 10);
+        else
+            c = (rng() % 8 == 0) ? static_cast<char>('0' + rng() % 10) : (style == 1 ? '9' : '0');
+    }
+    if (rng() % 3 == 0)
+        magnitude[0] = '1';
+    return Make(rng() % 2, magnitude);
+}
+
+void TestLimbArithmetic() {
+    std::mt19937_64 rng(11);
+    int cases = 0;
+    for (int i = 0; i < 4000; ++i) {
+        const Digits a = RandomOperand(rng), b = RandomOperand(rng);
+        const BigNumber x(Text(a)), y(Text(b));
+        const auto check = [&](const char* op, const BigNumber& got, const Digits& want) {
+            if (got.ToStdString() != Text(want))
+                Fail(Text(a) + " " + op + " " + Text(b) + " gives " + got.ToStdString());
+        };
+        check("+", x + y, Add(a, b));
+        check("-", x - y, Add(a, Negated(b)));
+        check("*", x * y, Multiply(a, b));
+        const int order = BigNumber::Compare(x, y);
+        if ((order > 0) - (order < 0) != Compare(a, b))
+            Fail("compare " + Text(a) + " with " + Text(b));
+        cases += 4;
+    }
+    Report("limbs", cases);
+}
+
+// Long carry and borrow chains at every length around the vector widths,
+// with fractional digits that line the operands up off a limb boundary.
+void TestCarryRuns() {
+    std::mt19937_64 rng(15);
+    int cases = 0;
+    for (std::size_t digits = 1; digits <= 400; digits += 1 + digits / 40) {
+        for (int i = 0; i < 6; ++i) {
+            std::string nines(digits, '9');
+            if (i % 2)
+                nines[rng() % digits] = static_cast<char>('0' + rng() % 10);
+            const Digits a = Make(false, nines);
+            const Digits b = Make(i >= 4, "1" + std::string(rng() % digits, '0'));
+            const BigNumber x(Text(a)), y(Text(b));
+            if ((x + y).ToStdString() != Text(Add(a, b)) ||
+                (y - x).ToStdString() != Text(Add(b, Negated(a))))
+                Fail("carry: " + Text(a) + " and " + Text(b));
+
+            const std::string fraction = "0." + RandomDigits(rng, 1 + rng() % 30);
+            const BigNumber z = BigNumber(i >= 4 ? "-" + fraction : fraction);
+            if ((x + z) - z != x || (x + z) - x != z || (z - x) + x != z)
+                Fail("carry: " + Text(a) + " and " + z.ToStdString());
+            cases += 5;
+        }
+    }
+    Report("carries", cases);
+}
+
+// Canonical text of random numbers up to tens of thousands of digits must
+// come back unchanged from every spelling of the same value: padded with
+// zeros, broken up by whitespace or written with an exponent.
+void TestTextRoundTrip() {
+    std::mt19937_64 rng(16);
+    int cases = 0;
+    for (int i = 0; i < 300; ++i) {
+        const std::size_t size = (i < 60) ? 1 + i : 1 + rng() % (i < 280 ? 2000 : 40000);
+        const bool negative = rng() % 2;
+        const std::string whole = (rng() % 4 == 0) ? "0" : RandomDigits(rng, size);
+        std::string fraction = (rng() % 3 == 0) ? "" : RandomDigits(rng, 1 + rng() % size);
+        if (!fraction.empty())
+            fraction.back() = static_cast<char>('1' + rng() % 9);
+        const std::string text = (negative && (whole != "0" || !fraction.empty()) ? "-" : "") +
+                                 whole + (fraction.empty() ? "" : "." + fraction);
+
+        const std::string sign = negative ? "-" : "";
+        const std::string padded = sign + std::string(rng() % 12, '0') + whole + "." +
+                                   fraction + std::string(rng() % 12, '0');
+        std::string spaced = padded;
+        spaced.insert(rng() % (spaced.size() + 1), " ");
+        const std::size_t shift = rng() % 50;
+        const std::string exponent = sign + "0." + std::string(shift, '0') + whole + fraction +
+                                     "e" + std::to_string(whole.size() + shift);
+
+        for (const std::string& spelling : {text, padded, " " + spaced + " ", exponent}) {
+            const std::string got = BigNumber(spelling).ToStdString();
+            if (got != text)
+                Fail("text: " + spelling.substr(0, 60) + "... prints as " + got.substr(0, 60));
+            ++cases;
+        }
+
+        std::string broken = text;
+        broken[rng() % broken.size()] = 'x';
+        try {
+            BigNumber parsed(broken);
+            Fail("text: accepted " + broken.substr(0, 60));
+        } catch (const std::invalid_argument&) {
+        }
+        ++cases;
+    }
+    Report("text", cases);
+}
+
+// Operands on either side of 10^36, where magnitudes move between inline
+// storage and limbs. Results that come back under the boundary must be
+// stored inline again, so they compare and hash like the parsed value.
+void TestInlineBoundary() {
+    std::mt19937_64 rng(12);
+    const std::string nines(36, '9');
+    const std::string kEdges[] = {
+        nines, "1" + std::string(36, '0'), "1" + std::string(35, '0') + "1",
+        std::string(18, '9'), "1" + std::string(18, '0'), "340282366920938463463374607431768211455"};
+    std::vector<Digits> operands;
+    for (const std::string& edge : kEdges) {
+        operands.push_back(Make(false, edge));
+        operands.push_back(Make(true, edge));
+    }
+    for (int i = 0; i < 40; ++i)
+        operands.push_back(Make(rng() % 2, RandomDigits(rng, 15 + rng() % 26)));
+
+    int cases = 0;
+    for (const Digits& a : operands) {
+        for (const Digits& b : operands) {
+            const BigNumber x(Text(a)), y(Text(b));
+            const std::pair<BigNumber, Digits> kResults[] = {
+                {x + y, Add(a, b)}, {x - y, Add(a, Negated(b))}, {x * y, Multiply(a, b)}};
+            for (const auto& [got, want] : kResults) {
+                const BigNumber parsed(Text(want));
+                if (got.ToStdString() != Text(want) || got != parsed || got.Hash() != parsed.Hash())
+                    Fail("inline: " + Text(a) + ", " + Text(b) + " gives " + got.ToStdString());
+                ++cases;
+            }
+        }
+    }
+    Report("inline", cases);
+}
+
+// In-place and rvalue operators against the const ones, including an
+// operand aliased with the result.
+void TestCompoundOperators() {
+    std::mt19937_64 rng(13);
+    int cases = 0;
+    const auto random_decimal = [&rng] {
+        return RandomInteger(rng, 1 + rng() % 60) * BigNumber::Pow10(-static_cast<int>(rng() % 12));
+    };
+    for (int i = 0; i < 300; ++i) {
+        const BigNumber x = random_decimal();
+        const BigNumber y = random_decimal();
+        const auto check = [&](const char* op, const BigNumber& got, const BigNumber& want) {
+            if (got != want)
+                Fail(std::string("operator ") + op + " on " + x.ToStdString() + ", " +
+                     y.ToStdString() + " gives " + got.ToStdString());
+            ++cases;
+        };
+
+        BigNumber t = x;
+        check("+=", t += y, x + y);
+        t = x;
+        check("-=", t -= y, x - y);
+        t = x;
+        check("*=", t *= y, x * y);
+        t = x;
+        check("/=", t /= y, x / y);
+
+        BigNumber u = x, v = y;
+        check("&& + const&", std::move(u) + y, x + y);
+        check("const& - &&", x - std::move(v), x - y);
+        u = x;
+        v = y;
+        check("&& * &&", std::move(u) * std::move(v), x * y);
+        u = x;
+        check("&& / const&", std::move(u) / y, x / y);
+
+        t = x;
+        check("x += x", t += t, x + x);
+        t = x;
+        check("x -= x", t -= t, BigNumber::Zero());
+        t = x;
+        check("x *= x", t *= t, x * x);
+        t = x;
+        check("x /= x", t /= t, BigNumber::One());
+    }
+    Report("compound", cases);
+}
+
+// Compare and Hash on decimals of different scales: the order must match
+// the digit strings aligned at the point, and every spelling of a value
+// must hash alike.
+void TestCompareAndHash() {
+    std::mt19937_64 rng(14);
+    int cases = 0;
+    for (int i = 0; i < 3000; ++i) {
+        const Digits a = RandomOperand(rng), b = RandomOperand(rng);
+        const int scale_a = static_cast<int>(rng() % 50), scale_b = static_cast<int>(rng() % 50);
+        const BigNumber x = BigNumber(Text(a)) * BigNumber::Pow10(-scale_a);
+        const BigNumber y = BigNumber(Text(b)) * BigNumber::Pow10(-scale_b);
+        const int common = std::max(scale_a, scale_b);
+        const Digits aligned_a = Make(a.negative, a.magnitude + std::string(common - scale_a, '0'));
+        const Digits aligned_b = Make(b.negative, b.magnitude + std::string(common - scale_b, '0'));
+        const int order = BigNumber::Compare(x, y);
+        if ((order > 0) - (order < 0) != Compare(aligned_a, aligned_b))
+            Fail("compare " + x.ToStdString() + " with " + y.ToStdString());
+        ++cases;
+    }
+
+    const char* const kSpellings[] = {
+        "1.5", "1.50", "15e-1", "0.0015e3", "+1.500000000000000000000000000000000000000000",
+        "150000000000000000000000000000000000000000000e-44"};
+    std::unordered_set<BigNumber> seen;
+    for (const char* spelling : kSpellings) {
+        const BigNumber value(spelling);
+        seen.insert(value);
+        if (BigNumber::Compare(value, BigNumber("1.5")) != 0 ||
+            value.Hash() != BigNumber("1.5").Hash())
+            Fail(std::string("hash: ") + spelling + " differs from 1.5");
+        ++cases;
+    }
+    if (seen.size() != 1)
+        Fail("hash: spellings of 1.5 are " + std::to_string(seen.size()) + " set entries");
+    if (BigNumber("-0").Hash() != BigNumber::Zero().Hash())
+        Fail("hash: -0 differs from 0");
+    cases += 2;
+    Report("compare", cases);
+}
+
+// --- Exponents -------------------------------------------------------------
+
+// Trailing zeros live in the exponent, so powers of ten near the limit cost
+// one digit, and results past the limit throw instead of wrapping.
+void TestExponentRange() {
+    int cases = 0;
+    const BigNumber huge("1e99999999"), tiny("1e-100000000");
+    if (huge.SignificantDigits() != 1 || !huge.IsPowerOfTen() || !huge.IsInteger())
+        Fail("exponent: 1e99999999 is not stored as one digit");
+    if (BigNumber("-3e-99999999").FractionalDigits() != 99999999)
+        Fail("exponent: fractional digits of 3e-99999999");
+    if (huge * BigNumber("1e-99999999") != BigNumber::One())
+        Fail("exponent: 1e99999999 * 1e-99999999 is not 1");
+    cases += 3;
+
+    const auto overflows = [](auto&& compute) {
+        try {
+            compute();
+        } catch (const std::overflow_error&) {
+            return true;
+        }
+        return false;
+    };
+    if (!overflows([&] { return tiny * tiny; }))
+        Fail("exponent: product of scales past the limit did not throw");
+    if (!overflows([&] { return huge * huge; }))
+        Fail("exponent: product of exponents past the limit did not throw");
+    if (!overflows([&] { return tiny.Percent(); }))
+        Fail("exponent: percent past the limit did not throw");
+    if (!overflows([] { return BigNumber::Pow10(-2147483647 - 1); }))
+        Fail("exponent: Pow10 of INT_MIN did not throw");
+    if ((BigNumber("2e-50000000") * BigNumber("5e-50000000")) != BigNumber("1e-99999999"))
+        Fail("exponent: product inside the limit is wrong");
+    cases += 5;
+    Report("exponent", cases);
+}
+
+// --- Precision and rounding ------------------------------------------------
+
+#if defined(__SIZEOF_INT128__)
+
+// a / b rounded to `digits` significant digits by `mode`, worked out in
+// 128-bit integers; |a| and |b| stay below 10^9 and digits at most 20.
+BigNumber RoundedQuotient(Int128 a, Int128 b, int digits, BigNumber::RoundingMode mode) {
+    const bool negative = (a < 0) != (b < 0);
+    Int128 num = a < 0 ? -a : a, den = b < 0 ? -b : b;
+    // Scale so that the integer quotient has exactly `digits` digits.
+    Int128 low = 1;
+    for (int i = 1; i < digits; ++i)
+        low *= 10;
+    int exponent = 0;
+    for (; num / den >= low * 10; ++exponent)
+        den *= 10;
+    for (; num / den < low; --exponent)
+        num *= 10;
+
+    Int128 q = num / den;
+    const Int128 twice_rest = 2 * (num % den);
+    bool up = false;
+    switch (mode) {
+    case BigNumber::RoundingMode::kHalfEven:
+        up = twice_rest > den || (twice_rest == den && q % 2 != 0);
+        break;
+    case BigNumber::RoundingMode::kHalfUp:
+        up = twice_rest >= den;
+        break;
+    case BigNumber::RoundingMode::kTruncate:
+        break;
+    case BigNumber::RoundingMode::kFloor:
+        up = negative && twice_rest != 0;
+        break;
+    case BigNumber::RoundingMode::kCeiling:
+        up = !negative && twice_rest != 0;
+        break;
+    }
+    if (up)
+        ++q;
+    return BigNumber(ToString(negative ? -q : q)) * BigNumber::Pow10(exponent);
+}
+
+// Divide and Round against RoundedQuotient for every mode, at precisions
+// from one digit up.
+void TestRounding() {
+    const BigNumber::RoundingMode kModes[] = {
+        BigNumber::RoundingMode::kHalfEven, BigNumber::RoundingMode::kHalfUp,
+        BigNumber::RoundingMode::kTruncate, BigNumber::RoundingMode::kFloor,
+        BigNumber::RoundingMode::kCeiling};
+    std::mt19937_64 rng(15);
+    int cases = 0;
+    for (int i = 0; i < 2000; ++i) {
+        // Small operands make exact quotients and ties common.
+        const Int128 limit = (i % 2) ? 1000000000 : 200;
+        const Int128 a = static_cast<Int128>(rng() % limit) * (rng() % 2 ? 1 : -1);
+        const Int128 b = static_cast<Int128>(1 + rng() % limit) * (rng() % 2 ? 1 : -1);
+        const int digits = 1 + static_cast<int>(rng() % 20);
+        for (BigNumber::RoundingMode mode : kModes) {
+            const BigNumber::Context context{digits, mode};
+            const BigNumber want = a == 0 ? BigNumber() : RoundedQuotient(a, b, digits, mode);
+            const BigNumber x(ToString(a)), y(ToString(b));
+            const BigNumber quotient = x.Divide(y, context);
+            if (quotient != want)
+                Fail("divide " + ToString(a) + " / " + ToString(b) + " to " +
+                     std::to_string(digits) + " digits gives " + quotient.ToStdString() +
+                     ", expected " + want.ToStdString());
+            const BigNumber rounded = x.Round(context);
+            if (a != 0 && rounded != RoundedQuotient(a, 1, digits, mode))
+                Fail("round " + ToString(a) + " to " + std::to_string(digits) + " digits gives " +
+                     rounded.ToStdString());
+            cases += 2;
+        }
+    }
+
+    // operator/ follows the context installed on the thread.
+    {
+        const BigNumber::ScopedContext context({5, BigNumber::RoundingMode::kFloor});
+        if ((BigNumber("-2") / BigNumber("3")).ToStdString() != "-0.66667")
+            Fail("operator/ ignores the scoped context");
+    }
+    const std::string two_thirds = (BigNumber("2") / BigNumber("3")).ToStdString();
+    if (two_thirds != "0." + std::string(39, '6') + "7")
+        Fail("operator/ does not default to 40 digits");
+    Report("rounding", cases + 2);
+}
+
+#endif
+
+// --- Multiplication and division algorithms --------------------------------
+
+// Each forces one algorithm down to tiny operands; "default" is the tuning
+// the engine ships with.
+std::vector<std::pair<const char*, BigNumber::Tuning>> TuningVariants() {
+    std::vector<std::pair<const char*, BigNumber::Tuning>> out;
+    out.push_back({"default", BigNumber::Tuning{}});
+
+    BigNumber::Tuning karatsuba = SimplestTuning();
+    karatsuba.karatsuba_threshold = 2;
+    out.push_back({"karatsuba", karatsuba});
+
+    BigNumber::Tuning toom3 = karatsuba;
+    toom3.toom3_threshold = 3;
+    out.push_back({"toom3", toom3});
+
+    // Where 128-bit integers are missing this is schoolbook again.
+    BigNumber::Tuning ntt = SimplestTuning();
+    ntt.ntt_threshold = 1;
+    out.push_back({"ntt", ntt});
+
+    BigNumber::Tuning newton = SimplestTuning();
+    newton.newton_div_threshold = 4;
+    out.push_back({"newton", newton});
+
+    // Every product split across threads, with Newton division on top.
+    BigNumber::Tuning parallel = toom3;
+    parallel.ntt_threshold = 40;
+    parallel.newton_div_threshold = 4;
+    parallel.parallel_threshold = 1;
+    parallel.threads = 4;
+    out.push_back({"parallel", parallel});
+    return out;
+}
+
+void TestMultiplicationAlgorithms() {
+    std::mt19937_64 rng(3);
+    const std::pair<std::size_t, std::size_t> kSizes[] = {
+        {20, 20}, {400, 380}, {3000, 2900}, {12000, 11000}, {20000, 700}, {9000, 4000}};
+    std::vector<std::pair<BigNumber, BigNumber>> operands;
+    std::vector<BigNumber> expected;
+    {
+        const ScopedTuning tuning(SimplestTuning());
+        for (const auto& [na, nb] : kSizes) {
+            operands.emplace_back(RandomInteger(rng, na), RandomInteger(rng, nb));
+            // A fractional operand checks that scales add up.
+            operands.back().second = operands.back().second * BigNumber::Pow10(-3);
+            expected.push_back(operands.back().first * operands.back().second);
+        }
+    }
+
+    int cases = 0;
+    for (const auto& [name, variant] : TuningVariants()) {
+        const ScopedTuning tuning(variant);
+        for (std::size_t i = 0; i < operands.size(); ++i) {
+            if (operands[i].first * operands[i].second != expected[i])
+                Fail(std::string("multiply: ") + name + " differs at size " +
+                     std::to_string(kSizes[i].first));
+            ++cases;
+        }
+    }
+    Report("multiply", cases);
+}
+
+void TestDivisionAlgorithms() {
+    std::mt19937_64 rng(4);
+    const std::pair<std::size_t, std::size_t> kSizes[] = {
+        {40, 12}, {900, 300}, {6000, 2500}, {16000, 8000}, {12000, 9}};
+    const BigNumber::Context kContext{5000, BigNumber::RoundingMode::kHalfEven};
+
+    int cases = 0;
+    for (const auto& [na, nb] : kSizes) {
+        const BigNumber a = RandomInteger(rng, na);
+        const BigNumber b = RandomInteger(rng, nb);
+        std::pair<BigNumber, BigNumber> want;
+        BigNumber want_quotient;
+        {
+            const ScopedTuning tuning(SimplestTuning());
+            want = BigNumber::DivMod(a, b);
+            want_quotient = a.Divide(b, kContext);
+        }
+        // a = q * b + r with |r| < |b| and r taking the sign of a.
+        const BigNumber& r = want.second;
+        BigNumber abs_r = r, abs_b = b;
+        if (abs_r.IsNegative())
+            abs_r.Negate();
+        if (abs_b.IsNegative())
+            abs_b.Negate();
+        if (want.first * b + r != a || abs_r >= abs_b ||
+            (!r.IsZero() && r.IsNegative() != a.IsNegative()))
+            Fail("divmod: identity fails at size " + std::to_string(na));
+
+        for (const auto& [name, variant] : TuningVariants()) {
+            const ScopedTuning tuning(variant);
+            if (BigNumber::DivMod(a, b) != want)
+                Fail(std::string("divmod: ") + name + " differs at size " + std::to_string(na));
+            if (a.Divide(b, kContext) != want_quotient)
+                Fail(std::string("divide: ") + name + " differs at size " + std::to_string(na));
+            ++cases;
+        }
+    }
+    Report("divide", cases);
+}
+
+// Gcd of multiples of a common factor: it must divide both, leave coprime
+// cofactors and be a multiple of the common factor.
+void TestGcd() {
+    std::mt19937_64 rng(5);
+    int cases = 0;
+    for (std::size_t digits : {5, 30, 200, 1500}) {
+        for (int i = 0; i < 4; ++i) {
+            const BigNumber common = RandomInteger(rng, digits / 2 + 1);
+            const BigNumber a = common * RandomInteger(rng, digits);
+            const BigNumber b = common * RandomInteger(rng, digits);
+            const BigNumber g = BigNumber::Gcd(a, b);
+            const auto [qa, ra] = BigNumber::DivMod(a, g);
+            const auto [qb, rb] = BigNumber::DivMod(b, g);
+            if (g.IsNegative() || !ra.IsZero() || !rb.IsZero() ||
+                BigNumber::Gcd(qa, qb) != BigNumber::One() ||
+                !BigNumber::DivMod(g, common).second.IsZero())
+                Fail("gcd: wrong at " + std::to_string(digits) + " digits");
+            ++cases;
+        }
+    }
+    Report("gcd", cases);
+}
+
+// DivideExactly against a truncated Divide checked by multiplying back.
+// Divisors are mostly 2^i * 5^j times a small factor, so exact quotients are
+// common, and a few powers run to thousands of digits.
+void TestDivideExactly() {
+    std::mt19937_64 rng(16);
+    const BigNumber two("2"), five("5");
+    int cases = 0;
+    for (int i = 0; i < 2000; ++i) {
+        BigNumber b = BigNumber(std::to_string(1 + rng() % 30)) *
+                      BigNumber::Pow10(-static_cast<int>(rng() % 6));
+        for (int twos = static_cast<int>(rng() % 40); twos > 0; --twos)
+            b *= two;
+        for (int fives = static_cast<int>(rng() % 30); fives > 0; --fives)
+            b *= five;
+        const BigNumber a = RandomInteger(rng, 1 + rng() % 25) *
+                            BigNumber::Pow10(static_cast<int>(rng() % 9) - 4);
+        const int max_digits = 1 + static_cast<int>(rng() % 50);
+
+        const BigNumber truncated = a.Divide(b, {max_digits, BigNumber::RoundingMode::kTruncate});
+        const bool fits = (truncated * b == a);
+        BigNumber quotient("7");
+        const bool exact = BigNumber::DivideExactly(a, b, max_digits, &quotient);
+        if (exact != fits || quotient != (fits ? truncated : BigNumber("7")))
+            Fail("divide exactly: " + a.ToStdString() + " / " + b.ToStdString() + " to " +
+                 std::to_string(max_digits) + " digits gives " + quotient.ToStdString());
+        ++cases;
+    }
+
+    // 1 / 2^5000 = 5^5000 / 10^5000 has 3495 significant digits.
+    BigNumber power = BigNumber::One();
+    for (int i = 0; i < 5000; ++i)
+        power *= two;
+    BigNumber quotient;
+    if (BigNumber::DivideExactly(BigNumber::One(), power, 3494, &quotient))
+        Fail("divide exactly: 1/2^5000 fits 3494 digits");
+    if (!BigNumber::DivideExactly(BigNumber::One(), power, 3495, &quotient) ||
+        quotient * power != BigNumber::One())
+        Fail("divide exactly: 1/2^5000 is wrong");
+    if (BigNumber::DivideExactly(BigNumber::One(), power * BigNumber("3"), 10000, &quotient))
+        Fail("divide exactly: 1/(3 * 2^5000) terminates");
+    Report("divide-exactly", cases + 3);
+}
+
+// --- Progress and cancellation ---------------------------------------------
+
+// Long multiplications, divisions and GCDs report progress to the control
+// installed on their thread and stop with Cancelled once it is cancelled,
+// also when that happens from another thread halfway through.
+void TestProgressAndCancel() {
+    std::mt19937_64 rng(17);
+    int cases = 0;
+    const BigNumber a = RandomInteger(rng, 60000), b = RandomInteger(rng, 30000);
+    {
+        BigNumber::ComputeControl control;
+        const BigNumber::ScopedControl scoped(&control);
+        const std::pair<const char*, std::function<void()>> kOperations[] = {
+            {"multiply", [&] { (void)(a * b); }},
+            {"divide", [&] { (void)a.Divide(b, {20000, BigNumber::RoundingMode::kHalfEven}); }},
+            {"gcd", [&] { (void)BigNumber::Gcd(a, b); }}};
+        for (const auto& [name, operation] : kOperations) {
+            control.SetProgress(0);
+            operation();
+            if (control.Progress() < 0.9 || control.Progress() > 1)
+                Fail(std::string("progress: ") + name + " ends at " +
+                     std::to_string(control.Progress()));
+            ++cases;
+        }
+    }
+
+    BigNumber::ComputeControl cancelled;
+    cancelled.Cancel();
+    const BigNumber x = RandomInteger(rng, 1000), y = RandomInteger(rng, 1000);
+    const std::pair<const char*, std::function<void()>> kCancelled[] = {
+        {"multiply", [&] { (void)(x * y); }},
+        {"divide", [&] { (void)x.Divide(y, {1000, BigNumber::RoundingMode::kHalfEven}); }},
+        {"gcd", [&] { (void)BigNumber::Gcd(x, y); }}};
+    for (const auto& [name, operation] : kCancelled) {
+        try {
+            const BigNumber::ScopedControl scoped(&cancelled);
+            operation();
+            Fail(std::string("cancel: ") + name + " ran to the end");
+        } catch (const BigNumber::Cancelled&) {
+        }
+        // The control belongs to the scope, not to the thread for good.
+        operation();
+        cases += 2;
+    }
+
+    // Cancelled from another thread while the worker keeps dividing.
+    BigNumber::ComputeControl control;
+    std::atomic<bool> stopped{false};
+    std::thread worker([&] {
+        const BigNumber::ScopedControl scoped(&control);
+        try {
+            for (int i = 0; i < 100000; ++i)
+                (void)a.Divide(b, {20000, BigNumber::RoundingMode::kHalfEven});
+        } catch (const BigNumber::Cancelled&) {
+            stopped = true;
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    control.Cancel();
+    worker.join();
+    if (!stopped)
+        Fail("cancel: a division loop was not stopped from another thread");
+    Report("cancel", cases + 1);
+}
+
+} // namespace
+
+int main() {
+    TestLimbArithmetic();
+    TestCarryRuns();
+    TestTextRoundTrip();
+    TestInlineBoundary();
+    TestCompoundOperators();
+    TestCompareAndHash();
+    TestExponentRange();
+#if defined(__SIZEOF_INT128__)
+    TestRounding();
+#endif
+    TestMultiplicationAlgorithms();
+    TestDivisionAlgorithms();
+    TestGcd();
+    TestDivideExactly();
+    TestProgressAndCancel();
+    return ExitCode();
+}
@@ -0,0 +1,158 @@
+#include "bigrational.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Reduction is skipped until num_ and den_ together have grown by this many
+// digits beyond twice their reduced size.
+constexpr int kReduceSlack = 64;
+
+} // namespace
+
+BigRational::BigRational() = default;
+
+BigRational::BigRational(const BigNumber& value)
+    : den_(BigNumber::Pow10(value.FractionalDigits())) {
+    num_ = value * den_;
+    reduced_digits_ = Digits();
+}
+
+BigRational::BigRational(std::string_view s) : BigRational(BigNumber(s)) {}
+
+bool BigRational::IsZero() const {
+    return num_.IsZero();
+}
+
+bool BigRational::IsNegative() const {
+    return num_.IsNegative();
+}
+
+BigRational BigRational::operator+(const BigRational& rhs) const {
+    BigRational out = *this;
+    out += rhs;
+    return out;
+}
+
+BigRational BigRational::operator-(const BigRational& rhs) const {
+    BigRational out = *this;
+    out -= rhs;
+    return out;
+}
+
+BigRational BigRational::operator*(const BigRational& rhs) const {
+    BigRational out = *this;
+    out *= rhs;
+    return out;
+}
+
+BigRational BigRational::operator/(const BigRational& rhs) const {
+    BigRational out = *this;
+    out /= rhs;
+    return out;
+}
+
+BigRational& BigRational::operator+=(const BigRational& rhs) {
+    AddInPlace(rhs, false);
+    return *this;
+}
+
+BigRational& BigRational::operator-=(const BigRational& rhs) {
+    AddInPlace(rhs, true);
+    return *this;
+}
+
+BigRational& BigRational::operator*=(const BigRational& rhs) {
+    num_ *= rhs.num_;
+    den_ *= rhs.den_;
+    MaybeReduce();
+    return *this;
+}
+
+BigRational& BigRational::operator/=(const BigRational& rhs) {
+    if (rhs.IsZero())
+        throw std::domain_error("BigRational: division by zero");
+
+    if (&rhs == this) {
+        *this = BigRational(BigNumber::One());
+        return *this;
+    }
+    num_ *= rhs.den_;
+    den_ *= rhs.num_;
+    if (den_.IsNegative()) {
+        num_.Negate();
+        den_.Negate();
+    }
+    MaybeReduce();
+    return *this;
+}
+
+BigRational& BigRational::Negate() {
+    num_.Negate();
+    return *this;
+}
+
+BigRational BigRational::Percent() const {
+    BigRational out = *this;
+    out.den_ *= BigNumber::Pow10(2);
+    out.MaybeReduce();
+    return out;
+}
+
+void BigRational::AddInPlace(const BigRational& rhs, bool negate_rhs) {
+    if (den_ == rhs.den_) {
+        if (negate_rhs)
+            num_ -= rhs.num_;
+        else
+            num_ += rhs.num_;
+    } else {
+        BigNumber cross = rhs.num_ * den_;
+        num_ *= rhs.den_;
+        if (negate_rhs)
+            num_ -= cross;
+        else
+            num_ += cross;
+        den_ *= rhs.den_;
+    }
+    MaybeReduce();
+}
+
+void BigRational::Reduce() {
+    if (num_.IsZero()) {
+        den_ = BigNumber::One();
+    } else {
+        const BigNumber g = BigNumber::Gcd(num_, den_);
+        if (!(g == BigNumber::One())) {
+            num_ = BigNumber::DivMod(num_, g).first;
+            den_ = BigNumber::DivMod(den_, g).first;
+        }
+    }
+    reduced_digits_ = Digits();
+}
+
+void BigRational::MaybeReduce() {
+    if (Digits() > 2 * reduced_digits_ + kReduceSlack)
+        Reduce();
+}
+
+BigNumber BigRational::ToBigNumber(const BigNumber::Context& context) const {
+    // Divide rounds the true quotient, which does not depend on common
+    // factors, and only ever drops zeros from one that fits the context; so
+    // x/7*7 comes out whole without reducing first, and 1/2^n is cut to
+    // context.digits instead of printing all n digits.
+    return num_.Divide(den_, context);
+}
+
+std::string BigRational::ToStdString() const {
+    return ToBigNumber(BigNumber::GetContext()).ToStdString();
+}
+
+std::string BigRational::ToFractionString() const {
+    return num_.ToStdString() + "/" + den_.ToStdString();
+}
+
+int BigRational::Digits() const {
+    return num_.SignificantDigits() + den_.SignificantDigits();
+}
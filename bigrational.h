@@ -0,0 +1,58 @@
+#pragma once
+
+#include "bignumber.h"
+
+#include <string>
+#include <string_view>
+
+// Exact fraction of two BigNumber integers. Arithmetic never rounds; the
+// only division happens when the value is converted back to a decimal.
+// Common factors are cancelled lazily, once the operands have grown enough
+// for a GCD to pay for itself.
+class BigRational final
+{
+public:
+    BigRational();
+    explicit BigRational(const BigNumber& value);
+    explicit BigRational(std::string_view s);
+
+    bool IsZero() const;
+    bool IsNegative() const;
+
+    BigRational operator+(const BigRational& rhs) const;
+    BigRational operator-(const BigRational& rhs) const;
+    BigRational operator*(const BigRational& rhs) const;
+    BigRational operator/(const BigRational& rhs) const;
+
+    BigRational& operator+=(const BigRational& rhs);
+    BigRational& operator-=(const BigRational& rhs);
+    BigRational& operator*=(const BigRational& rhs);
+    BigRational& operator/=(const BigRational& rhs);
+
+    BigRational& Negate();
+    BigRational Percent() const;
+
+    // Cancels common factors now instead of waiting for the lazy trigger.
+    void Reduce();
+
+    // The single rounding step: numerator / denominator under context. A
+    // value that fits in context.digits significant digits comes out
+    // exactly, whether or not the fraction has been reduced yet.
+    BigNumber ToBigNumber(const BigNumber::Context& context) const;
+    // Uses the calling thread's BigNumber context.
+    std::string ToStdString() const;
+    // "numerator/denominator", exact but not necessarily reduced.
+    std::string ToFractionString() const;
+    // Significant digits of numerator and denominator together.
+    int Digits() const;
+
+private:
+    // value = num_ / den_, with den_ > 0 and both integers.
+    BigNumber num_;
+    BigNumber den_ = BigNumber::One();
+    // Size of num_ and den_ right after the last reduction.
+    int reduced_digits_ = 0;
+
+    void AddInPlace(const BigRational& rhs, bool negate_rhs);
+    void MaybeReduce();
+};
@@ -0,0 +1,118 @@
+// BigRational against exact fractions computed in 128-bit integers.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "formula.h"
+#include "testsupport.h"
+
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+#if defined(__SIZEOF_INT128__)
+
+// `value` as a terminating decimal, when its denominator is 2^i * 5^j.
+std::optional<BigNumber> TerminatingDecimal(const Fraction& value) {
+    Int128 den = value.den;
+    int twos = 0, fives = 0;
+    for (; den % 2 == 0; den /= 2)
+        ++twos;
+    for (; den % 5 == 0; den /= 5)
+        ++fives;
+    if (den != 1)
+        return std::nullopt;
+    const int shift = std::max(twos, fives);
+    Int128 scaled = value.num;
+    for (int i = twos; i < shift; ++i) {
+        if (__builtin_mul_overflow(scaled, 2, &scaled))
+            return std::nullopt;
+    }
+    for (int i = fives; i < shift; ++i) {
+        if (__builtin_mul_overflow(scaled, 5, &scaled))
+            return std::nullopt;
+    }
+    return BigNumber(ToString(scaled)) * BigNumber::Pow10(-shift);
+}
+
+// Random expressions evaluated in BigRational against their 128-bit
+// fractions, and converted to decimals the same way whether or not the
+// fraction has been reduced yet.
+void TestExactMatchesReference() {
+    std::mt19937_64 rng(2);
+    int cases = 0;
+    for (int i = 0; i < 3000; ++i) {
+        const Reference ref = RandomReference(rng, 5);
+        if (ref.overflow)
+            continue;
+        const Formula program = Formula::Compile(ref.text);
+        BigRational got;
+        try {
+            got = program.Evaluate<BigRational>();
+        } catch (const std::domain_error&) {
+            if (ref.value)
+                Fail("exact: " + ref.text + " threw");
+            ++cases;
+            continue;
+        }
+        if (!ref.value) {
+            Fail("exact: " + ref.text + " should divide by zero");
+            continue;
+        }
+
+        // ToBigNumber must not depend on whether the fraction was reduced.
+        const BigNumber::Context narrow{3, BigNumber::RoundingMode::kHalfEven};
+        const BigNumber::Context wide{40, BigNumber::RoundingMode::kHalfEven};
+        const BigNumber unreduced = got.ToBigNumber(narrow);
+        const BigNumber unreduced_wide = got.ToBigNumber(wide);
+        got.Reduce();
+        const std::string want = ToString(ref.value->num) + "/" + ToString(ref.value->den);
+        if (got.ToFractionString() != want)
+            Fail("exact: " + ref.text + " gives " + got.ToFractionString() + ", expected " + want);
+        if (unreduced != got.ToBigNumber(narrow) || unreduced_wide != got.ToBigNumber(wide))
+            Fail("exact: " + ref.text + " converts differently before reduction");
+
+        // Values with finitely many digits print exactly when they fit the
+        // context and are rounded like any other value when they do not.
+        const std::optional<BigNumber> decimal = TerminatingDecimal(*ref.value);
+        if (decimal && (unreduced != decimal->Round(narrow) ||
+                        unreduced_wide != decimal->Round(wide)))
+            Fail("exact: " + ref.text + " printed " + unreduced_wide.ToStdString());
+        ++cases;
+    }
+
+    // The same 33-digit integer, once through an unreduced fraction.
+    const BigRational big = Formula::Compile("123456789012345678901234567890124/7*7")
+                                .Evaluate<BigRational>();
+    const BigRational plain = Formula::Compile("123456789012345678901234567890124*1")
+                                  .Evaluate<BigRational>();
+    const BigNumber::Context kDigits30{30, BigNumber::RoundingMode::kHalfEven};
+    if (big.ToBigNumber({40, BigNumber::RoundingMode::kHalfEven}).ToStdString() !=
+        "123456789012345678901234567890124")
+        Fail("exact: x/7*7 lost digits");
+    if (big.ToBigNumber(kDigits30) != plain.ToBigNumber(kDigits30))
+        Fail("exact: x/7*7 and x*1 round differently");
+
+    // A terminating value longer than the context is cut to it.
+    BigNumber power_of_two = BigNumber::One();
+    for (int i = 0; i < 300; ++i)
+        power_of_two *= BigNumber("2");
+    const BigRational tiny = BigRational(BigNumber::One()) / BigRational(power_of_two);
+    if (tiny.ToBigNumber(kDigits30).SignificantDigits() > 30)
+        Fail("exact: 1/2^300 printed " + tiny.ToBigNumber(kDigits30).ToStdString());
+    Report("exact", cases + 3);
+}
+
+#endif
+
+} // namespace
+
+int main() {
+#if defined(__SIZEOF_INT128__)
+    TestExactMatchesReference();
+#endif
+    return ExitCode();
+}
@@ -1,263 +1,185 @@
 #include "calculatormodel.h"
 #include "bignumber.h"
-
-#include <vector>
+#include "bigrational.h"
+#include "certifieddouble.h"
+#include "fixeddecimal.h"
+#include "formula.h"
+
+#include <QTimer>
+#include <QtConcurrent>
+#include <cstddef>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace {
 
 constexpr int kMaxDigitsInNumber = 25;
 
-struct Token {
-    enum Kind { kNumber, kOp, kLParen, kRParen, kPercent } kind;
-    QString text;
-};
+// Quotients are only computed to the digits the display can show, plus a few
+// guard digits so chained operations do not eat into them. The
+// display truncates, so division does too.
+constexpr int kGuardDigits = 5;
+const BigNumber::Context kDisplayContext{kMaxDigitsInNumber + kGuardDigits,
+                                         BigNumber::RoundingMode::kTruncate};
 
-int Precedence(const Token& t) {
-    if (t.kind == Token::kPercent) return 2;
-    if (t.kind == Token::kOp && (t.text == "*" || t.text == "/")) return 2;
-    if (t.kind == Token::kOp && (t.text == "+" || t.text == "-")) return 1;
-    return 0;
-}
+constexpr std::size_t kResultCacheBytes = 1 << 20;
+constexpr std::size_t kHistorySize = 16;
 
-bool IsLeftAssoc(const Token& t) {
-    return t.kind != Token::kPercent;
-}
+// The preview runs on the GUI thread, so it leaves out a previous result too
+// large to compute with between keystrokes.
+constexpr int kMaxPreviewAnsDigits = 2000;
 
-bool IsOperatorToken(const Token& t) {
-    return t.kind == Token::kOp || t.kind == Token::kPercent;
-}
+constexpr int kProgressIntervalMs = 100;
+
+// Name the previous result is bound to while it leads the expression.
+const char kAnsVariable[] = "Ans";
 
 bool IsDigitQChar(QChar c) {
     return c >= '0' && c <= '9';
 }
 
-std::vector<Token> Tokenize(const QString& expr) {
-    std::vector<Token> tokens;
-    Token::Kind prev_kind = Token::kOp;
-    int i = 0;
-
-    while (i < expr.size()) {
-        const QChar c = expr[i];
-        if (c.isSpace() || c == '=') {
-            ++i;
-            continue;
-        }
-
-        if (c == '(') {
-            tokens.push_back({Token::kLParen, "("});
-            prev_kind = Token::kLParen;
-            ++i;
-            continue;
-        }
-
-        if (c == ')') {
-            tokens.push_back({Token::kRParen, ")"});
-            prev_kind = Token::kRParen;
-            ++i;
-            continue;
-        }
-
-        if (c == '%') {
-            tokens.push_back({Token::kPercent, "%"});
-            prev_kind = Token::kPercent;
-            ++i;
-            continue;
-        }
-
-        if (c == '+' || c == '-' || c == '*' || c == '/') {
-            const bool may_be_unary_minus =
-                (c == '-') &&
-                (prev_kind == Token::kOp || prev_kind == Token::kLParen ||
-                 prev_kind == Token::kPercent);
-
-            if (!may_be_unary_minus) {
-                tokens.push_back({Token::kOp, QString(c)});
-                prev_kind = Token::kOp;
-                ++i;
-                continue;
-            }
-        }
-
-        if (IsDigitQChar(c) || c == '.' || c == '-') {
-            int start = i;
-            bool seen_dot = false;
-            bool seen_digit = false;
-
-            if (expr[i] == '-') {
-                ++i;
-            }
-
-            while (i < expr.size()) {
-                const QChar ch = expr[i];
-                if (IsDigitQChar(ch)) {
-                    seen_digit = true;
-                    ++i;
-                    continue;
-                }
-                if (ch == '.') {
-                    if (seen_dot) break;
-                    seen_dot = true;
-                    ++i;
-                    continue;
-                }
-                break;
-            }
-
-            const QString num = expr.mid(start, i - start);
-            if (!seen_digit) {
-                throw std::runtime_error("bad number");
-            }
+// The engine works on std::string; BigNumber and BigRational both qualify.
+template <typename Value>
+QString ToQString(const Value& value) {
+    return QString::fromStdString(value.ToStdString());
+}
 
-            tokens.push_back({Token::kNumber, num});
-            prev_kind = Token::kNumber;
-            continue;
+#if defined(__SIZEOF_INT128__)
+// Everyday input (prices, short sums, a division that comes out even) fits
+// in a single 128-bit integer. Digits matches kDisplayContext, so whenever
+// InteractiveDecimal holds a quotient exactly, BigNumber would not have
+// rounded it either and both modes print the same text.
+using InteractiveDecimal = FixedDecimal<kMaxDigitsInNumber + kGuardDigits, 12>;
+
+// Evaluates program with InteractiveDecimal; nullopt means a step was not
+// exact (or divided by zero) and the caller must use BigNumber/BigRational.
+std::optional<BigNumber> EvaluateFixed(const Formula& program, bool exact,
+                                       const BigRational* ans) {
+    try {
+        std::vector<InteractiveDecimal> variables;
+        if (ans) {
+            const BigNumber value = ans->ToBigNumber(kDisplayContext);
+            // Exact mode must see Ans itself, not its rounded decimal.
+            if (exact && !(BigRational(value) - *ans).IsZero())
+                return std::nullopt;
+            variables.emplace_back(value);
         }
-
-        throw std::runtime_error("unknown token");
+        return program.Evaluate(variables).ToBigNumber();
+    } catch (const FixedDecimalInexact&) {
+        return std::nullopt;
     }
-
-    return tokens;
 }
+#endif
 
-std::vector<Token> ToRpn(const std::vector<Token>& tokens) {
-    std::vector<Token> out;
-    std::vector<Token> stack;
-
-    for (const Token& t : tokens) {
-        if (t.kind == Token::kNumber) {
-            out.push_back(t);
-            continue;
-        }
-
-        if (t.kind == Token::kLParen) {
-            stack.push_back(t);
-            continue;
-        }
-
-        if (t.kind == Token::kRParen) {
-            while (!stack.empty() && stack.back().kind != Token::kLParen) {
-                out.push_back(stack.back());
-                stack.pop_back();
-            }
-
-            if (stack.empty() || stack.back().kind != Token::kLParen) {
-                throw std::runtime_error("mismatched parens");
-            }
+} // namespace
 
-            stack.pop_back();
-            continue;
-        }
+// Реализация методов CalculatorModel
+CalculatorModel::CalculatorModel(QObject* parent)
+    : QObject(parent), cache_(kResultCacheBytes),
+      watcher_(std::make_unique<QFutureWatcher<Outcome>>()),
+      progress_timer_(std::make_unique<QTimer>()) {
+    connect(watcher_.get(), &QFutureWatcher<Outcome>::finished,
+            this, &CalculatorModel::OnEvaluationFinished);
+    progress_timer_->setInterval(kProgressIntervalMs);
+    connect(progress_timer_.get(), &QTimer::timeout,
+            this, &CalculatorModel::OnProgressTimer);
+    EmitAll();
+}
 
-        if (IsOperatorToken(t)) {
-            while (!stack.empty() && IsOperatorToken(stack.back())) {
-                const Token& top = stack.back();
-                const int p1 = Precedence(t);
-                const int p2 = Precedence(top);
+CalculatorModel::~CalculatorModel() {
+    // The worker keeps its own reference to the control and drops the
+    // result; it only has to stop early.
+    if (control_)
+        control_->Cancel();
+}
 
-                if ((IsLeftAssoc(t) && p1 <= p2) ||
-                    (!IsLeftAssoc(t) && p1 < p2)) {
-                    out.push_back(top);
-                    stack.pop_back();
-                } else {
-                    break;
-                }
-            }
+BigNumber::Context CalculatorModel::DisplayContext() {
+    return kDisplayContext;
+}
 
-            stack.push_back(t);
-            continue;
-        }
+void CalculatorModel::EmitAll() {
+    emit ExpressionChanged(expression_);
+    emit DisplayChanged(display_);
+    UpdatePreview();
+}
 
-        throw std::runtime_error("bad token");
-    }
+void CalculatorModel::SetPreviewOperand(const QString& number) {
+    const std::string text = number.toStdString();
+    FeedPreview([&text](auto& preview) { preview.SetOperandText(text); });
+}
 
-    while (!stack.empty()) {
-        if (stack.back().kind == Token::kLParen ||
-            stack.back().kind == Token::kRParen) {
-            throw std::runtime_error("mismatched parens");
-        }
+void CalculatorModel::StartPreviewOperand() {
+    // The tokenizer reads '-' after '%' as the sign of the operand that
+    // follows, which then has no operator before it and fails to evaluate.
+    if (expression_.endsWith("%-"))
+        FeedPreview([](auto& preview) { preview.Invalidate(); });
+}
 
-        out.push_back(stack.back());
-        stack.pop_back();
+void CalculatorModel::SetPreviewToAns() {
+    if (ans_.Digits() > kMaxPreviewAnsDigits) {
+        FeedPreview([](auto& preview) { preview.Invalidate(); });
+        return;
     }
-
-    return out;
+    exact_preview_.SetOperand(ans_);
+    const BigNumber rounded = ans_.ToBigNumber(kDisplayContext);
+    decimal_preview_.SetOperand(rounded);
+    // Widened to take in ans_ itself as well as its rounded form.
+    certified_preview_.SetOperand(
+        CertifiedDouble(rounded.ToStdString()).Round(kDisplayContext));
 }
 
-QString EvalRpn(const std::vector<Token>& rpn) {
-    std::vector<BigNumber> stack;
-
-    for (const Token& t : rpn) {
-        if (t.kind == Token::kNumber) {
-            stack.push_back(BigNumber(t.text));
-            continue;
-        }
-
-        if (t.kind == Token::kPercent) {
-            if (stack.empty()) {
-                throw std::runtime_error("percent without operand");
-            }
-
-            BigNumber x = stack.back();
-            stack.pop_back();
-            stack.push_back(x.Percent());
-            continue;
-        }
-
-        if (t.kind == Token::kOp) {
-            if (stack.size() < 2) {
-                throw std::runtime_error("op without operands");
-            }
-
-            BigNumber b = stack.back();
-            stack.pop_back();
-            BigNumber a = stack.back();
-            stack.pop_back();
-
-            if (t.text == "+") {
-                stack.push_back(a + b);
-            } else if (t.text == "-") {
-                stack.push_back(a - b);
-            } else if (t.text == "*") {
-                stack.push_back(a * b);
-            } else if (t.text == "/") {
-                stack.push_back(a / b);
-            } else {
-                throw std::runtime_error("unknown op");
+void CalculatorModel::UpdatePreview() {
+    // A lone number would only repeat the display.
+    QString text;
+    const bool single_number = expression_.isEmpty() ||
+        (last_ == LastToken::kNumber && current_number_start_ == 0);
+    if (!single_number) {
+        const BigNumber::ScopedContext context(kDisplayContext);
+        // Most previews are settled by the double-double filter. Rounding
+        // its bound to the display context covers the division that turns
+        // an exact result into text.
+        CertifiedDouble estimate;
+        std::string digits;
+        if (certified_preview_.Preview(&estimate) &&
+            estimate.Round(kDisplayContext).ToTruncatedString(kMaxDigitsInNumber, &digits)) {
+            ++preview_stats_.certified;
+            text = QString::fromStdString(digits);
+        } else {
+            ++preview_stats_.fallbacks;
+            try {
+                if (eval_mode_ == EvalMode::kExact) {
+                    BigRational value;
+                    if (exact_preview_.Preview(&value))
+                        text = TruncateNumber(ToQString(value));
+                } else {
+                    BigNumber value;
+                    if (decimal_preview_.Preview(&value))
+                        text = TruncateNumber(ToQString(value));
+                }
+            } catch (const std::exception&) {
+                text.clear();
             }
-
-            continue;
         }
-
-        throw std::runtime_error("bad rpn");
-    }
-
-    if (stack.size() != 1) {
-        throw std::runtime_error("bad expression");
     }
-
-    return stack.back().ToQString();
-}
-
-} // namespace
-
-// Реализация методов CalculatorModel
-CalculatorModel::CalculatorModel(QObject* parent) : QObject(parent) {
-    EmitAll();
-}
-
-void CalculatorModel::EmitAll() {
-    emit ExpressionChanged(expression_);
-    emit DisplayChanged(display_);
+    if (text == preview_)
+        return;
+    preview_ = text;
+    emit PreviewChanged(preview_);
 }
 
 void CalculatorModel::ClearAll() {
+    CancelEvaluation();
     expression_.clear();
+    ans_linked_ = false;
     display_ = "0";
     last_ = LastToken::kStart;
     open_parens_ = 0;
     close_parens_ = 0;
     current_number_start_ = -1;
+    FeedPreview([](auto& preview) { preview.Reset(); });
     EmitAll();
 }
 
@@ -346,6 +268,8 @@ void CalculatorModel::AppendToken(const QString& token, LastToken new_last) {
 }
 
 void CalculatorModel::AppendChar(QChar c, LastToken new_last) {
+    if (current_number_start_ == 0)
+        ans_linked_ = false;
     expression_ += c;
     last_ = new_last;
     if (new_last != LastToken::kNumber)
@@ -355,6 +279,8 @@ void CalculatorModel::AppendChar(QChar c, LastToken new_last) {
 void CalculatorModel::ReplaceCurrentNumber(const QString& new_number) {
     if (last_ != LastToken::kNumber || current_number_start_ < 0)
         return;
+    if (current_number_start_ == 0)
+        ans_linked_ = false;
     expression_ = expression_.left(current_number_start_) + new_number;
 }
 
@@ -377,6 +303,8 @@ void CalculatorModel::SetDisplayFromCurrentOrZero() {
 }
 
 void CalculatorModel::InputDigit(int digit) {
+    if (computing_)
+        return;
     if (digit < 0 || digit > 9)
         return;
 
@@ -386,9 +314,11 @@ void CalculatorModel::InputDigit(int digit) {
             return;
         }
         TrimTrailingSpaces();
+        StartPreviewOperand();
         current_number_start_ = expression_.size();
         AppendToken(QString::number(digit), LastToken::kNumber);
         display_ = CurrentNumber();
+        SetPreviewOperand(display_);
         EmitAll();
         return;
     }
@@ -407,19 +337,24 @@ void CalculatorModel::InputDigit(int digit) {
         AppendChar(QChar('0' + digit), LastToken::kNumber);
     }
     display_ = CurrentNumber();
+    SetPreviewOperand(display_);
     EmitAll();
 }
 
 void CalculatorModel::InputDecimalPoint() {
+    if (computing_)
+        return;
     if (last_ != LastToken::kNumber) {
         if (last_ == LastToken::kCloseParen || last_ == LastToken::kPercent) {
             EmitAll();
             return;
         }
         TrimTrailingSpaces();
+        StartPreviewOperand();
         current_number_start_ = expression_.size();
         AppendToken("0.", LastToken::kNumber);
         display_ = CurrentNumber();
+        SetPreviewOperand(display_);
         EmitAll();
         return;
     }
@@ -431,10 +366,13 @@ void CalculatorModel::InputDecimalPoint() {
 
     AppendChar('.', LastToken::kNumber);
     display_ = CurrentNumber();
+    SetPreviewOperand(display_);
     EmitAll();
 }
 
 void CalculatorModel::InputOperator(QChar op) {
+    if (computing_)
+        return;
     if (op != '+' && op != '-' && op != '*' && op != '/')
         return;
 
@@ -445,6 +383,9 @@ void CalculatorModel::InputOperator(QChar op) {
 
     TrimTrailingSpaces();
 
+    const char op_char = op.toLatin1();
+    FeedPreview([op_char](auto& preview) { preview.SetOperator(op_char); });
+
     if (last_ == LastToken::kOperator) {
         if (!expression_.isEmpty())
             expression_.chop(1);
@@ -472,16 +413,20 @@ bool CalculatorModel::ShouldOpenParen() const {
 }
 
 void CalculatorModel::InputParen() {
+    if (computing_)
+        return;
     TrimTrailingSpaces();
 
     bool open_allowed = ShouldOpenParen();
     bool close_allowed = CanCloseParen();
 
     if (open_allowed) {
+        StartPreviewOperand();
         expression_ += '(';
         ++open_parens_;
         last_ = LastToken::kOpenParen;
         current_number_start_ = -1;
+        FeedPreview([](auto& preview) { preview.OpenParen(); });
         EmitAll();
         return;
     }
@@ -491,6 +436,7 @@ void CalculatorModel::InputParen() {
         ++close_parens_;
         last_ = LastToken::kCloseParen;
         current_number_start_ = -1;
+        FeedPreview([](auto& preview) { preview.CloseParen(); });
         EmitAll();
         return;
     }
@@ -499,8 +445,15 @@ void CalculatorModel::InputParen() {
 }
 
 void CalculatorModel::ToggleSign() {
+    if (computing_)
+        return;
+    // A number glued to ")" or "%" is not an operand the preview can follow.
+    if (last_ == LastToken::kCloseParen || last_ == LastToken::kPercent)
+        FeedPreview([](auto& preview) { preview.Invalidate(); });
+
     if (last_ != LastToken::kNumber) {
         TrimTrailingSpaces();
+        StartPreviewOperand();
         current_number_start_ = expression_.size();
         AppendToken("0", LastToken::kNumber);
     }
@@ -511,21 +464,36 @@ void CalculatorModel::ToggleSign() {
     } else {
         n.prepend('-');
     }
+    // Flipping the sign of the previous result keeps it at full precision.
+    const bool keep_ans = ans_linked_ && current_number_start_ == 0;
     ReplaceCurrentNumber(n);
+    if (keep_ans) {
+        ans_.Negate();
+        ans_text_ = n;
+        ans_linked_ = true;
+        SetPreviewToAns();
+    } else {
+        SetPreviewOperand(n);
+    }
     display_ = CurrentNumber();
     EmitAll();
 }
 
 void CalculatorModel::InputPercent() {
+    if (computing_)
+        return;
     if (last_ == LastToken::kNumber || last_ == LastToken::kCloseParen) {
         expression_ += '%';
         last_ = LastToken::kPercent;
         current_number_start_ = -1;
+        FeedPreview([](auto& preview) { preview.Percent(); });
     }
     EmitAll();
 }
 
 void CalculatorModel::Equals() {
+    if (computing_)
+        return;
     if (!expression_.isEmpty()) {
         if (last_ == LastToken::kOperator || last_ == LastToken::kOpenParen) {
             EmitAll();
@@ -535,18 +503,115 @@ void CalculatorModel::Equals() {
             expression_ += ')';
             ++close_parens_;
             last_ = LastToken::kCloseParen;
+            FeedPreview([](auto& preview) { preview.CloseParen(); });
         }
     }
 
-    QString result;
-    QString err;
-    if (!TryEvaluate(&result, &err)) {
-        display_ = "Error";
-        EmitAll();
+    const bool exact = (eval_mode_ == EvalMode::kExact);
+    const bool use_ans = ans_linked_ && expression_.startsWith(ans_text_);
+    const std::string text =
+        (use_ans ? QString(kAnsVariable) + expression_.mid(ans_text_.size())
+                 : expression_).toStdString();
+    // The key comes from the unoptimized program: optimizing folds the
+    // constant arithmetic, which is most of the work a hit should save.
+    std::string key;
+    try {
+        key = Formula::Compile(text, /*optimize=*/false).CanonicalText();
+    } catch (const std::exception&) {
+        ShowError();
+        return;
+    }
+
+    // The context is fixed, so the mode, the program and the value of Ans
+    // decide the result.
+    key.insert(0, exact ? "q " : "d ");
+    if (use_ans)
+        key += " " + std::string(kAnsVariable) + "=" + ans_.ToFractionString();
+    if (const ResultCache::Result* cached = cache_.Find(key)) {
+        const ResultCache::Result result = *cached;
+        FinishEquals(result.text, result.value);
         return;
     }
 
-    result = TruncateNumber(result);
+    auto control = std::make_shared<BigNumber::ComputeControl>();
+    control_ = control;
+    pending_key_ = std::move(key);
+    SetComputing(true);
+    const BigRational ans = use_ans ? ans_ : BigRational();
+    watcher_->setFuture(QtConcurrent::run(
+        [text, exact, use_ans, ans, control] {
+            return Evaluate(text, exact, use_ans ? &ans : nullptr, *control);
+        }));
+}
+
+CalculatorModel::Outcome CalculatorModel::Evaluate(
+        const std::string& text, bool exact, const BigRational* ans,
+        const BigNumber::ComputeControl& control) {
+    const BigNumber::ScopedContext context(kDisplayContext);
+    const BigNumber::ScopedControl scoped_control(&control);
+    Outcome outcome;
+    try {
+        // Optimizing does the constant arithmetic, so it runs here where it
+        // can be cancelled rather than on the GUI thread.
+        const Formula program = Formula::Compile(text);
+#if defined(__SIZEOF_INT128__)
+        if (const std::optional<BigNumber> value = EvaluateFixed(program, exact, ans)) {
+            outcome.text = ToQString(*value);
+            outcome.value = BigRational(*value);
+            outcome.ok = true;
+            return outcome;
+        }
+#endif
+        // BigNumber rounds at every division; BigRational stays exact and
+        // rounds once when printed.
+        if (exact) {
+            std::vector<BigRational> variables;
+            if (ans)
+                variables.push_back(*ans);
+            outcome.value = program.Evaluate(variables);
+            outcome.text = ToQString(outcome.value);
+        } else {
+            std::vector<BigNumber> variables;
+            if (ans)
+                variables.push_back(ans->ToBigNumber(kDisplayContext));
+            const BigNumber value = program.Evaluate(variables);
+            outcome.text = ToQString(value);
+            outcome.value = BigRational(value);
+        }
+        outcome.ok = true;
+    } catch (const BigNumber::Cancelled&) {
+        outcome.cancelled = true;
+    } catch (const std::exception& e) {
+        outcome.error = QString::fromLatin1(e.what());
+    }
+    return outcome;
+}
+
+void CalculatorModel::OnEvaluationFinished() {
+    // A cancelled evaluation has already been given up on.
+    if (!computing_)
+        return;
+    const Outcome outcome = watcher_->result();
+    control_.reset();
+    SetComputing(false);
+    if (!outcome.ok) {
+        ShowError();
+        return;
+    }
+    cache_.Insert(pending_key_, {outcome.text, outcome.value});
+    FinishEquals(outcome.text, outcome.value);
+}
+
+void CalculatorModel::FinishEquals(const QString& result_text,
+                                   const BigRational& value) {
+    const QString result = TruncateNumber(result_text);
+    history_.push_front(value);
+    if (history_.size() > kHistorySize)
+        history_.pop_back();
+    ans_ = value;
+    ans_text_ = result;
+    ans_linked_ = true;
+
     const QString old_expr = expression_;
     display_ = result;
     expression_ = old_expr + "=";
@@ -556,17 +621,42 @@ void CalculatorModel::Equals() {
     last_ = LastToken::kNumber;
     current_number_start_ = 0;
     open_parens_ = close_parens_ = 0;
+    FeedPreview([](auto& preview) { preview.Reset(); });
+    SetPreviewToAns();
+    UpdatePreview();
 }
 
-bool CalculatorModel::TryEvaluate(QString* out_result, QString* out_error) {
-    try {
-        const std::vector<Token> tokens = Tokenize(expression_);
-        const std::vector<Token> rpn = ToRpn(tokens);
-        *out_result = EvalRpn(rpn);
-        return true;
-    } catch (const std::exception& e) {
-        if (out_error)
-            *out_error = QString::fromLatin1(e.what());
-        return false;
-    }
+void CalculatorModel::ShowError() {
+    display_ = "Error";
+    EmitAll();
+}
+
+void CalculatorModel::CancelEvaluation() {
+    if (!computing_)
+        return;
+    control_->Cancel();
+    control_.reset();
+    SetComputing(false);
+}
+
+void CalculatorModel::OnProgressTimer() {
+    if (!control_)
+        return;
+    const int percent = static_cast<int>(control_->Progress() * 100);
+    if (percent == progress_)
+        return;
+    progress_ = percent;
+    emit ProgressChanged(progress_);
+}
+
+void CalculatorModel::SetComputing(bool computing) {
+    if (computing_ == computing)
+        return;
+    computing_ = computing;
+    progress_ = 0;
+    if (computing_)
+        progress_timer_->start();
+    else
+        progress_timer_->stop();
+    emit ComputingChanged(computing_);
 }
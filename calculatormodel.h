@@ -1,8 +1,20 @@
 #pragma once
 
+#include "bignumber.h"
+#include "bigrational.h"
+#include "certifieddouble.h"
+#include "previewevaluator.h"
+#include "resultcache.h"
+
+#include <QFutureWatcher>
 #include <QObject>
 #include <QString>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <string>
+
+class QTimer;
 
 class CalculatorModel final : public QObject
 {
@@ -10,10 +22,45 @@ class CalculatorModel final : public QObject
 
 public:
     explicit CalculatorModel(QObject* parent = nullptr);
-    ~CalculatorModel() override = default;
+    ~CalculatorModel() override;
+
+    // kDecimal rounds at every division; kExact carries fractions and
+    // divides once for the final result.
+    enum class EvalMode {
+        kDecimal,
+        kExact
+    };
 
     QString Expression() const { return expression_; }
     QString Display() const { return display_; }
+    // Value of the expression as typed so far; empty when it would only
+    // repeat the display or cannot be computed.
+    QString Preview() const { return preview_; }
+    EvalMode Mode() const { return eval_mode_; }
+    // Equals() evaluates on a worker thread. Until it finishes, input other
+    // than ClearAll() is ignored; ClearAll() cancels it.
+    bool IsComputing() const { return computing_; }
+    // How far the running evaluation has got, in percent of the arithmetic
+    // operation it is in; updated a few times a second.
+    int Progress() const { return progress_; }
+    void SetEvalMode(EvalMode mode) { eval_mode_ = mode; UpdatePreview(); }
+
+    // Results of earlier evaluations are reused by Equals().
+    ResultCache::Stats CacheStats() const { return cache_.GetStats(); }
+
+    // Previews shown straight from the double-double filter, and previews
+    // that needed BigNumber or BigRational because its bound could not
+    // settle every displayed digit.
+    struct PreviewStats {
+        std::uint64_t certified = 0;
+        std::uint64_t fallbacks = 0;
+    };
+    PreviewStats PreviewFilterStats() const { return preview_stats_; }
+
+    // The last result at full precision, and the ones before it, most
+    // recent first.
+    const BigRational& Ans() const { return ans_; }
+    const std::deque<BigRational>& History() const { return history_; }
 
 public slots:
     void ClearAll();
@@ -28,6 +75,9 @@ public slots:
 signals:
     void DisplayChanged(const QString& display);
     void ExpressionChanged(const QString& expr);
+    void PreviewChanged(const QString& preview);
+    void ComputingChanged(bool computing);
+    void ProgressChanged(int percent);
 
 private:
     enum class LastToken {
@@ -42,6 +92,41 @@ private:
     QString expression_;
     QString display_ = "0";
     LastToken last_ = LastToken::kStart;
+    EvalMode eval_mode_ = EvalMode::kDecimal;
+    ResultCache cache_;
+
+    // After Equals() the expression starts with the truncated result text.
+    // Until that number is edited, evaluation reads ans_ in its place.
+    BigRational ans_;
+    QString ans_text_;
+    bool ans_linked_ = false;
+    std::deque<BigRational> history_;
+
+    // Both modes are followed on every key so switching modes mid-expression
+    // keeps the preview.
+    PreviewEvaluator<BigRational> exact_preview_;
+    PreviewEvaluator<BigNumber> decimal_preview_;
+    // Encloses both of the above, so whatever digits it settles are the
+    // ones either mode would show.
+    PreviewEvaluator<CertifiedDouble> certified_preview_;
+    PreviewStats preview_stats_;
+    QString preview_;
+
+    struct Outcome {
+        QString text;
+        BigRational value;
+        QString error;
+        bool ok = false;
+        bool cancelled = false;
+    };
+
+    std::unique_ptr<QFutureWatcher<Outcome>> watcher_;
+    std::shared_ptr<BigNumber::ComputeControl> control_;
+    std::string pending_key_;
+    bool computing_ = false;
+    // The worker only stores into control_; the GUI thread samples it.
+    std::unique_ptr<QTimer> progress_timer_;
+    int progress_ = 0;
 
     int open_parens_ = 0;
     int close_parens_ = 0;
@@ -55,6 +140,21 @@ private:
     void SetDisplayFromCurrentOrZero();
     void EmitAll();
 
+    // Decimal-mode divisions are rounded as they are reduced, so they need
+    // the same context as TryEvaluate().
+    template <typename Fn>
+    void FeedPreview(Fn fn) {
+        const BigNumber::ScopedContext context(DisplayContext());
+        fn(exact_preview_);
+        fn(decimal_preview_);
+        fn(certified_preview_);
+    }
+    static BigNumber::Context DisplayContext();
+    void StartPreviewOperand();
+    void SetPreviewOperand(const QString& number);
+    void SetPreviewToAns();
+    void UpdatePreview();
+
     void ReplaceCurrentNumber(const QString& new_number);
     void AppendToken(const QString& token, LastToken new_last);
     void AppendChar(QChar c, LastToken new_last);
@@ -63,5 +163,14 @@ private:
 
     bool CanCloseParen() const;
     bool ShouldOpenParen() const;
-    bool TryEvaluate(QString* out_result, QString* out_error = nullptr);
+    // Runs on a worker thread and touches no model state.
+    static Outcome Evaluate(const std::string& text, bool exact,
+                            const BigRational* ans,
+                            const BigNumber::ComputeControl& control);
+    void OnEvaluationFinished();
+    void OnProgressTimer();
+    void FinishEquals(const QString& result, const BigRational& value);
+    void ShowError();
+    void CancelEvaluation();
+    void SetComputing(bool computing);
 };
@@ -0,0 +1,371 @@
+#include "certifieddouble.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+
+namespace {
+
+// Relative error charged to each double-double operation. The published
+// bounds for the algorithms below are at most 15 u^2 (u = 2^-53), about
+// 2^-102; this leaves a wide margin.
+constexpr double kOpError = 0x1p-96;
+// Covers the rounding of the double arithmetic that computes the bounds.
+constexpr double kSlack = 1.0 + 0x1p-40;
+// Range in which none of the error-free transformations underflow.
+constexpr double kMinMagnitude = 0x1p-400;
+constexpr double kMaxMagnitude = 0x1p400;
+// Powers of ten that are exact doubles.
+constexpr int kMaxExactPow10 = 22;
+constexpr double kPow10[kMaxExactPow10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+// Significant digits of parsed text that are kept; the rest only widen the
+// bound.
+constexpr int kParseDigits = 32;
+// Decimal digits ToTruncatedString splits its integer into.
+constexpr double kDigitChunk = 1e12;
+constexpr int kDigitChunkDigits = 12;
+// The integer must stay below 2^53 * kDigitChunk.
+constexpr int kMaxTruncatedDigits = 27;
+
+struct DoubleDouble {
+    double hi;
+    double lo;
+};
+
+double TwoSum(double a, double b, double* err) {
+    const double s = a + b;
+    const double bb = s - a;
+    *err = (a - (s - bb)) + (b - bb);
+    return s;
+}
+
+// Needs |a| >= |b|.
+double QuickTwoSum(double a, double b, double* err) {
+    const double s = a + b;
+    *err = b - (s - a);
+    return s;
+}
+
+double TwoProd(double a, double b, double* err) {
+    const double p = a * b;
+    *err = std::fma(a, b, -p);
+    return p;
+}
+
+DoubleDouble Add(DoubleDouble a, DoubleDouble b) {
+    double s2 = 0.0, t2 = 0.0;
+    double s1 = TwoSum(a.hi, b.hi, &s2);
+    const double t1 = TwoSum(a.lo, b.lo, &t2);
+    s2 += t1;
+    s1 = QuickTwoSum(s1, s2, &s2);
+    s2 += t2;
+    s1 = QuickTwoSum(s1, s2, &s2);
+    return {s1, s2};
+}
+
+DoubleDouble Mul(DoubleDouble a, DoubleDouble b) {
+    double p2 = 0.0;
+    double p1 = TwoProd(a.hi, b.hi, &p2);
+    p2 += a.hi * b.lo + a.lo * b.hi;
+    p1 = QuickTwoSum(p1, p2, &p2);
+    return {p1, p2};
+}
+
+// Three quotient digits, each correcting the remainder of the last.
+DoubleDouble Div(DoubleDouble a, DoubleDouble b) {
+    const double q1 = a.hi / b.hi;
+    DoubleDouble r = Add(a, Mul(b, {-q1, 0.0}));
+    const double q2 = r.hi / b.hi;
+    r = Add(r, Mul(b, {-q2, 0.0}));
+    const double q3 = r.hi / b.hi;
+    double lo = 0.0;
+    const double hi = QuickTwoSum(q1, q2, &lo);
+    return Add({hi, lo}, {q3, 0.0});
+}
+
+} // namespace
+
+CertifiedDouble::CertifiedDouble(double hi, double lo, double err)
+    : hi_(hi), lo_(lo), err_(err) {}
+
+CertifiedDouble::CertifiedDouble(std::string_view s) {
+    std::size_t pos = 0;
+    bool negative = false;
+    if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+        negative = (s[pos++] == '-');
+
+    // Digits are taken 15 at a time, so every chunk and its power of ten
+    // are exact doubles.
+    constexpr int kChunkDigits = 15;
+    long long exponent = 0;
+    int kept = 0;
+    int chunk_digits = 0;
+    double chunk = 0.0;
+    bool any_digit = false;
+    bool seen_point = false;
+    bool dropped_nonzero = false;
+    const auto flush = [this, &chunk, &chunk_digits] {
+        *this *= CertifiedDouble(kPow10[chunk_digits], 0.0, 0.0);
+        *this += CertifiedDouble(chunk, 0.0, 0.0);
+        chunk = 0.0;
+        chunk_digits = 0;
+    };
+    for (; pos < s.size(); ++pos) {
+        const char c = s[pos];
+        if (c == '.' && !seen_point) {
+            seen_point = true;
+            continue;
+        }
+        if (c < '0' || c > '9')
+            break;
+        any_digit = true;
+        const int digit = c - '0';
+        if (kept == 0 && digit == 0) {
+            if (seen_point)
+                --exponent;
+            continue;
+        }
+        if (kept < kParseDigits) {
+            chunk = chunk * 10 + digit;
+            ++chunk_digits;
+            ++kept;
+            if (seen_point)
+                --exponent;
+            if (chunk_digits == kChunkDigits)
+                flush();
+        } else {
+            dropped_nonzero |= (digit != 0);
+            if (!seen_point)
+                ++exponent;
+        }
+    }
+    if (chunk_digits > 0)
+        flush();
+
+    if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+        ++pos;
+        bool exponent_negative = false;
+        if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+            exponent_negative = (s[pos++] == '-');
+        long long value = 0;
+        const std::size_t begin = pos;
+        for (; pos < s.size() && s[pos] >= '0' && s[pos] <= '9'; ++pos) {
+            value = value * 10 + (s[pos] - '0');
+            if (value > 100000) {
+                *this = Unbounded();
+                return;
+            }
+        }
+        if (pos == begin) {
+            *this = Unbounded();
+            return;
+        }
+        exponent += exponent_negative ? -value : value;
+    }
+    if (!any_digit || pos != s.size()) {
+        *this = Unbounded();
+        return;
+    }
+
+    // The digits dropped after the kept ones add less than one unit.
+    if (dropped_nonzero)
+        err_ += 1.0;
+    if (exponent < -100000 || exponent > 100000) {
+        *this = Unbounded();
+        return;
+    }
+    MultiplyByPow10(static_cast<int>(exponent));
+    if (negative)
+        Negate();
+}
+
+CertifiedDouble CertifiedDouble::Unbounded() {
+    return CertifiedDouble(0.0, 0.0, std::numeric_limits<double>::infinity());
+}
+
+bool CertifiedDouble::IsBounded() const {
+    return std::isfinite(err_);
+}
+
+double CertifiedDouble::Magnitude() const {
+    return (std::fabs(hi_) + std::fabs(lo_)) * (1.0 + 0x1p-50);
+}
+
+CertifiedDouble& CertifiedDouble::Finish(double hi, double lo, double err) {
+    hi_ = hi;
+    lo_ = lo;
+    err_ = (err + Magnitude() * kOpError) * kSlack;
+    if (!std::isfinite(hi_) || !std::isfinite(err_) ||
+        (hi_ != 0.0 && (std::fabs(hi_) < kMinMagnitude || std::fabs(hi_) > kMaxMagnitude)))
+        *this = Unbounded();
+    return *this;
+}
+
+CertifiedDouble& CertifiedDouble::operator+=(const CertifiedDouble& rhs) {
+    const DoubleDouble sum = Add({hi_, lo_}, {rhs.hi_, rhs.lo_});
+    return Finish(sum.hi, sum.lo, err_ + rhs.err_);
+}
+
+CertifiedDouble& CertifiedDouble::operator-=(const CertifiedDouble& rhs) {
+    const DoubleDouble difference = Add({hi_, lo_}, {-rhs.hi_, -rhs.lo_});
+    return Finish(difference.hi, difference.lo, err_ + rhs.err_);
+}
+
+CertifiedDouble& CertifiedDouble::operator*=(const CertifiedDouble& rhs) {
+    const double propagated =
+        Magnitude() * rhs.err_ + rhs.Magnitude() * err_ + err_ * rhs.err_;
+    const DoubleDouble product = Mul({hi_, lo_}, {rhs.hi_, rhs.lo_});
+    return Finish(product.hi, product.lo, propagated);
+}
+
+CertifiedDouble& CertifiedDouble::Divide(const CertifiedDouble& rhs) {
+    // Every divisor within the bound is at least `lowest` in magnitude.
+    const double lowest =
+        (std::fabs(rhs.hi_) * (1.0 - 0x1p-51) - rhs.err_ * kSlack) * (1.0 - 0x1p-50);
+    if (!(lowest > 0.0))
+        return *this = Unbounded();
+    const DoubleDouble quotient = Div({hi_, lo_}, {rhs.hi_, rhs.lo_});
+    // |x/y - a/b| <= (|a - x| + |a/b| |b - y|) / |y| for x, y within the
+    // bounds of a and b.
+    const double magnitude = (std::fabs(quotient.hi) + std::fabs(quotient.lo)) * kSlack;
+    return Finish(quotient.hi, quotient.lo, (err_ + magnitude * rhs.err_) / lowest);
+}
+
+CertifiedDouble& CertifiedDouble::operator/=(const CertifiedDouble& rhs) {
+    Divide(rhs);
+    return *this = Round(BigNumber::GetContext());
+}
+
+CertifiedDouble& CertifiedDouble::Negate() {
+    hi_ = -hi_;
+    lo_ = -lo_;
+    return *this;
+}
+
+// BigNumber and BigRational take percentages exactly.
+CertifiedDouble CertifiedDouble::Percent() const {
+    CertifiedDouble out = *this;
+    out.Divide(CertifiedDouble(100.0, 0.0, 0.0));
+    return out;
+}
+
+CertifiedDouble CertifiedDouble::Round(const BigNumber::Context& context) const {
+    if (context.digits < 1)
+        return Unbounded();
+    // Rounding to d digits moves a number by less than 10^(1-d) of it; the
+    // factor absorbs the inaccuracy of pow.
+    const double unit = std::pow(10.0, 1 - context.digits) * 1.01;
+    CertifiedDouble out = *this;
+    out.err_ = (err_ + (Magnitude() + err_) * unit) * kSlack;
+    if (!std::isfinite(out.err_))
+        return Unbounded();
+    return out;
+}
+
+CertifiedDouble& CertifiedDouble::MultiplyByPow10(int exponent) {
+    while (exponent != 0 && IsBounded()) {
+        const int step = std::min(std::abs(exponent), kMaxExactPow10);
+        const CertifiedDouble power(kPow10[step], 0.0, 0.0);
+        if (exponent > 0) {
+            *this *= power;
+            exponent -= step;
+        } else {
+            Divide(power);
+            exponent += step;
+        }
+    }
+    return *this;
+}
+
+bool CertifiedDouble::ToTruncatedString(int digits, std::string* out) const {
+    if (!IsBounded() || hi_ == 0.0 || digits < 1 || digits > kMaxTruncatedDigits)
+        return false;
+    CertifiedDouble scaled = *this;
+    const bool negative = hi_ < 0.0;
+    if (negative)
+        scaled.Negate();
+
+    // A guess at the number of integer digits, checked against the result.
+    int integer_digits = 1;
+    for (double p = 10.0; scaled.hi_ >= p && integer_digits <= digits; p *= 10.0)
+        ++integer_digits;
+    if (integer_digits > digits)
+        return false;
+    const int fraction_digits = digits - integer_digits;
+    scaled.MultiplyByPow10(fraction_digits);
+    if (!scaled.IsBounded())
+        return false;
+
+    // t = floor(scaled), exactly. When hi_ is not an integer, lo_ (at most
+    // half an ulp of it) cannot carry it across one.
+    double t_hi = std::floor(scaled.hi_);
+    double t_lo = 0.0;
+    if (t_hi == scaled.hi_)
+        t_hi = QuickTwoSum(t_hi, std::floor(scaled.lo_), &t_lo);
+
+    // Every enclosed number must lie strictly between t and t + 1.
+    CertifiedDouble fraction = scaled;
+    fraction -= CertifiedDouble(t_hi, t_lo, 0.0);
+    if (!fraction.IsBounded())
+        return false;
+    const double margin = (std::fabs(fraction.lo_) + fraction.err_) * kSlack + 0x1p-50;
+    if (!(fraction.hi_ > margin && 1.0 - fraction.hi_ > margin))
+        return false;
+
+    // t < 10^27 splits into high * 10^12 + low with both parts exact.
+    double high = std::floor(t_hi / kDigitChunk);
+    double rest = std::fma(-high, kDigitChunk, t_hi);
+    if (rest < 0.0) {
+        high -= 1.0;
+        rest += kDigitChunk;
+    } else if (rest >= kDigitChunk) {
+        high += 1.0;
+        rest -= kDigitChunk;
+    }
+    const auto chunk = static_cast<std::int64_t>(kDigitChunk);
+    std::int64_t low = static_cast<std::int64_t>(rest) + static_cast<std::int64_t>(t_lo);
+    std::int64_t high_int = static_cast<std::int64_t>(high) + low / chunk;
+    low %= chunk;
+    if (low < 0) {
+        low += chunk;
+        --high_int;
+    }
+    if (high_int < 0)
+        return false;
+
+    std::string number;
+    if (high_int > 0) {
+        const std::string low_text = std::to_string(low);
+        number = std::to_string(high_int) +
+                 std::string(kDigitChunkDigits - low_text.size(), '0') + low_text;
+    } else {
+        number = std::to_string(low);
+    }
+
+    // The integer part must have the digits guessed above; below one it is
+    // a single zero.
+    const int size = static_cast<int>(number.size());
+    std::string text = negative ? "-" : "";
+    if (size > fraction_digits) {
+        if (size - fraction_digits != integer_digits)
+            return false;
+        text.append(number, 0, static_cast<std::size_t>(integer_digits));
+        number.erase(0, static_cast<std::size_t>(integer_digits));
+    } else {
+        if (integer_digits != 1)
+            return false;
+        text += '0';
+        number.insert(0, static_cast<std::size_t>(fraction_digits - size), '0');
+    }
+    if (fraction_digits > 0) {
+        text += '.';
+        text += number;
+    }
+    *out = std::move(text);
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "bignumber.h"
+
+#include <string>
+#include <string_view>
+
+// A double-double approximation (hi + lo, about 32 significant digits)
+// together with a rigorous bound on its distance from the number it stands
+// for. Each operation adds its own rounding error to the bound, so the
+// bound always encloses the exact result. Division also widens it by one
+// unit in the last place of the thread's BigNumber context, so it encloses
+// what BigNumber's rounded quotient would be as well as the exact value.
+//
+// Values that leave the range the error analysis covers (roughly 1e-120 to
+// 1e120), divisions by a bound that includes zero and unparsable text give
+// an unbounded value, which certifies nothing. Operations never throw.
+class CertifiedDouble final
+{
+public:
+    // Exactly zero.
+    CertifiedDouble() = default;
+    // Decimal text as BigNumber reads it.
+    explicit CertifiedDouble(std::string_view s);
+
+    static CertifiedDouble Unbounded();
+    bool IsBounded() const;
+
+    CertifiedDouble& operator+=(const CertifiedDouble& rhs);
+    CertifiedDouble& operator-=(const CertifiedDouble& rhs);
+    CertifiedDouble& operator*=(const CertifiedDouble& rhs);
+    CertifiedDouble& operator/=(const CertifiedDouble& rhs);
+
+    CertifiedDouble& Negate();
+    CertifiedDouble Percent() const;
+    CertifiedDouble operator%(int /*percent_token*/) const { return Percent(); }
+
+    // Widens the bound to take in any rounding of the enclosed numbers to
+    // context.digits significant digits, in any rounding mode.
+    CertifiedDouble Round(const BigNumber::Context& context) const;
+
+    // The enclosed numbers written out and cut, without rounding, after
+    // `digits` digits counted from the first digit of the integer part (the
+    // units digit for magnitudes below one). Succeeds only when every
+    // enclosed number gives the same text and none of them ends within
+    // those digits, so the text always has all of them.
+    bool ToTruncatedString(int digits, std::string* out) const;
+
+private:
+    // The approximation is hi_ + lo_ with |lo_| at most half an ulp of hi_;
+    // the number lies within err_ of it. err_ is infinite when unbounded.
+    double hi_ = 0.0;
+    double lo_ = 0.0;
+    double err_ = 0.0;
+
+    CertifiedDouble(double hi, double lo, double err);
+
+    // An upper bound on |hi_ + lo_|.
+    double Magnitude() const;
+    // Sets the approximation to hi + lo with `err` on top of the propagated
+    // error and checks the range.
+    CertifiedDouble& Finish(double hi, double lo, double err);
+    // Division without the rounding widening of operator/=.
+    CertifiedDouble& Divide(const CertifiedDouble& rhs);
+    CertifiedDouble& MultiplyByPow10(int exponent);
+};
@@ -0,0 +1,109 @@
+// CertifiedDouble against exact results: every truncated text the filter
+// certifies must agree with BigRational and with BigNumber.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "certifieddouble.h"
+#include "formula.h"
+#include "testsupport.h"
+
+#include <cstddef>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// One unit in the last place of text.
+BigRational LastPlace(const std::string& text) {
+    const std::size_t point = text.find('.');
+    const int decimals = point == std::string::npos
+                             ? 0 : static_cast<int>(text.size() - point - 1);
+    return BigRational(BigNumber::Pow10(-decimals));
+}
+
+// Whether cut is value with the digits after its last place dropped.
+bool IsTruncationOf(const BigRational& value, const std::string& cut) {
+    BigRational difference = value - BigRational(BigNumber(cut));
+    if (value.IsNegative())
+        difference.Negate();
+    return !difference.IsNegative() && (difference - LastPlace(cut)).IsNegative();
+}
+
+// A random expression as text, with *value set to the same expression
+// evaluated in CertifiedDouble.
+std::string RandomCertified(std::mt19937_64& rng, int depth, CertifiedDouble* value) {
+    if (depth == 0 || rng() % 3 == 0) {
+        std::string text = RandomDigits(rng, 1 + rng() % 6);
+        if (rng() % 2)
+            text.insert(text.size() > 2 ? text.size() - 2 : 0, text.size() > 2 ? "." : "0.");
+        if (rng() % 4 == 0)
+            text.insert(0, "-");
+        *value = CertifiedDouble(text);
+        return text;
+    }
+
+    static const char kOps[] = "+-*/";
+    const char op = kOps[rng() % 4];
+    CertifiedDouble rhs;
+    const std::string lhs_text = RandomCertified(rng, depth - 1, value);
+    const std::string rhs_text = RandomCertified(rng, depth - 1, &rhs);
+    switch (op) {
+    case '+':
+        *value += rhs;
+        break;
+    case '-':
+        *value -= rhs;
+        break;
+    case '*':
+        *value *= rhs;
+        break;
+    default:
+        *value /= rhs;
+        break;
+    }
+    return "(" + lhs_text + op + rhs_text + ")";
+}
+
+// Whenever the filter certifies a truncated text, both the exact value and
+// BigNumber's rounded one must truncate to it.
+void TestCertifiedDouble() {
+    constexpr int kDigits = 25;
+    const BigNumber::Context context{30, BigNumber::RoundingMode::kHalfEven};
+    const BigNumber::ScopedContext scoped(context);
+    std::mt19937_64 rng(7);
+    int cases = 0, certified = 0;
+    for (int i = 0; i < 3000; ++i) {
+        CertifiedDouble value;
+        const std::string expression = RandomCertified(rng, 4, &value);
+        std::string text;
+        if (!value.Round(context).ToTruncatedString(kDigits, &text)) {
+            ++cases;
+            continue;
+        }
+        const Formula program = Formula::Compile(expression, false);
+        BigRational exact;
+        BigNumber decimal;
+        try {
+            exact = program.Evaluate<BigRational>();
+            decimal = program.Evaluate<BigNumber>();
+        } catch (const std::domain_error&) {
+            Fail("certified: " + expression + " divides by zero but gives " + text);
+            continue;
+        }
+        ++certified;
+        if (!IsTruncationOf(exact, text) || !IsTruncationOf(BigRational(decimal), text))
+            Fail("certified: " + expression + " gives " + text);
+        ++cases;
+    }
+    if (certified == 0)
+        Fail("certified: nothing was certified");
+    Report("certified-double", cases, ", " + std::to_string(certified) + " certified");
+}
+
+} // namespace
+
+int main() {
+    TestCertifiedDouble();
+    return ExitCode();
+}
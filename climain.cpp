@@ -0,0 +1,289 @@
+// secretcalc-cli: evaluates one expression per input line and prints one
+// result per output line, in input order. Lines are evaluated in blocks on
+// a work-stealing thread pool; only a bounded number of blocks is in flight
+// at a time, so memory stays flat however long the input is.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "formula.h"
+#include "threadpool.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SECRETCALC_HAVE_MMAP 1
+#else
+#include <fstream>
+#endif
+
+namespace {
+
+constexpr std::size_t kBlockLines = 512;
+constexpr std::size_t kBlocksPerThread = 4;
+
+const char kUsage[] =
+    "usage: secretcalc-cli [--exact | --decimal] [--digits N] [--threads N] [FILE]\n"
+    "\n"
+    "Reads one expression per line from FILE, or from standard input when FILE\n"
+    "is missing or '-', and prints one result per line in the same order.\n"
+    "Expressions use the calculator's syntax: numbers, + - * /, postfix %\n"
+    "and parentheses. Failed lines print \"Error: \" and the reason.\n"
+    "\n"
+    "  --exact      divide exactly and round once at the end (default)\n"
+    "  --decimal    round at every division, like a pocket calculator\n"
+    "  --digits N   significant digits kept by division (default 30)\n"
+    "  --threads N  worker threads (default: one per hardware thread); with more\n"
+    "               than one, each expression is evaluated on a single thread\n";
+
+struct Options {
+    bool exact = true;
+    BigNumber::Context context{30, BigNumber::RoundingMode::kTruncate};
+    std::size_t threads = 0;
+    std::string path;
+};
+
+// A run of input lines. The views point into `text` or into the mapped file.
+struct Block {
+    std::string text;
+    std::vector<std::string_view> lines;
+};
+
+class LineInput {
+public:
+    virtual ~LineInput() = default;
+    // Fills `block` with up to kBlockLines lines; false at the end of input.
+    virtual bool Next(Block* block) = 0;
+};
+
+class StreamInput final : public LineInput {
+public:
+    explicit StreamInput(std::istream& in) : in_(in) {}
+
+    bool Next(Block* block) override {
+        block->text.clear();
+        block->lines.clear();
+        std::vector<std::size_t> ends;
+        std::string line;
+        while (ends.size() < kBlockLines && std::getline(in_, line)) {
+            block->text += line;
+            ends.push_back(block->text.size());
+        }
+        std::size_t begin = 0;
+        for (std::size_t end : ends) {
+            block->lines.emplace_back(block->text.data() + begin, end - begin);
+            begin = end;
+        }
+        return !ends.empty();
+    }
+
+private:
+    std::istream& in_;
+};
+
+#if defined(SECRETCALC_HAVE_MMAP)
+class MappedInput final : public LineInput {
+public:
+    explicit MappedInput(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+            }
+            data_ = static_cast<const char*>(data);
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    ~MappedInput() override {
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+
+    bool Next(Block* block) override {
+        block->text.clear();
+        block->lines.clear();
+        while (block->lines.size() < kBlockLines && pos_ < size_) {
+            const void* newline = std::memchr(data_ + pos_, '\n', size_ - pos_);
+            const std::size_t end = newline
+                ? static_cast<std::size_t>(static_cast<const char*>(newline) - data_)
+                : size_;
+            block->lines.emplace_back(data_ + pos_, end - pos_);
+            pos_ = newline ? end + 1 : size_;
+        }
+        return !block->lines.empty();
+    }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t pos_ = 0;
+};
+#endif
+
+std::string EvaluateLine(std::string_view line, const Options& options) {
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    if (line.find_first_not_of(" \t") == std::string_view::npos)
+        return std::string();
+
+    try {
+        const Formula program = Formula::Compile(line);
+        if (options.exact)
+            return program.Evaluate<BigRational>().ToStdString();
+        return program.Evaluate<BigNumber>().ToStdString();
+    } catch (const std::exception& e) {
+        return std::string("Error: ") + e.what();
+    }
+}
+
+std::string EvaluateBlock(const Block& block, const Options& options) {
+    const BigNumber::ScopedContext context(options.context);
+    std::string out;
+    for (std::string_view line : block.lines) {
+        out += EvaluateLine(line, options);
+        out += '\n';
+    }
+    return out;
+}
+
+bool ParseCount(const char* text, long min, long* out) {
+    char* end = nullptr;
+    const long value = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < min)
+        return false;
+    *out = value;
+    return true;
+}
+
+// Returns false after printing a message when the arguments are unusable.
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        long value = 0;
+        if (arg == "-h" || arg == "--help") {
+            std::fputs(kUsage, stdout);
+            std::exit(0);
+        } else if (arg == "--exact") {
+            options->exact = true;
+        } else if (arg == "--decimal") {
+            options->exact = false;
+        } else if (arg == "--digits" && i + 1 < argc && ParseCount(argv[i + 1], 1, &value)) {
+            options->context.digits = static_cast<int>(value);
+            ++i;
+        } else if (arg == "--threads" && i + 1 < argc && ParseCount(argv[i + 1], 1, &value)) {
+            options->threads = static_cast<std::size_t>(value);
+            ++i;
+        } else if ((arg == "-" || arg[0] != '-') && options->path.empty()) {
+            options->path = arg;
+        } else {
+            std::fputs(kUsage, stderr);
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<LineInput> OpenInput(const std::string& path) {
+    if (path.empty() || path == "-")
+        return std::make_unique<StreamInput>(std::cin);
+#if defined(SECRETCALC_HAVE_MMAP)
+    return std::make_unique<MappedInput>(path);
+#else
+    struct FileInput final : LineInput {
+        explicit FileInput(const std::string& path) : file(path), lines(file) {
+            if (!file)
+                throw std::runtime_error("cannot open " + path);
+        }
+        bool Next(Block* block) override { return lines.Next(block); }
+        std::ifstream file;
+        StreamInput lines;
+    };
+    return std::make_unique<FileInput>(path);
+#endif
+}
+
+void Write(const std::string& text) {
+    if (std::fwrite(text.data(), 1, text.size(), stdout) != text.size())
+        throw std::runtime_error("write failed");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
+
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+        return 2;
+
+    try {
+        std::unique_ptr<LineInput> input = OpenInput(options.path);
+        ThreadPool pool(options.threads);
+        // Blocks already keep every worker busy; parallel kernels inside
+        // them would only start the engine's own pool on top of this one.
+        // A single worker leaves them on, for inputs of a few huge lines.
+        if (pool.Size() > 1) {
+            BigNumber::Tuning tuning = BigNumber::GetTuning();
+            tuning.threads = 1;
+            BigNumber::SetTuning(tuning);
+        }
+        const std::size_t max_in_flight = kBlocksPerThread * pool.Size();
+
+        // Results are written front to back, so the output keeps the input
+        // order while later blocks are still being evaluated.
+        std::deque<std::future<std::string>> in_flight;
+        for (;;) {
+            auto block = std::make_shared<Block>();
+            if (!input->Next(block.get()))
+                break;
+            in_flight.push_back(pool.Submit(
+                [block, &options] { return EvaluateBlock(*block, options); }));
+            if (in_flight.size() >= max_in_flight) {
+                Write(in_flight.front().get());
+                in_flight.pop_front();
+            }
+        }
+        while (!in_flight.empty()) {
+            Write(in_flight.front().get());
+            in_flight.pop_front();
+        }
+        if (std::fflush(stdout) != 0)
+            throw std::runtime_error("write failed");
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "secretcalc-cli: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "bignumber.h"
+
+#include <stdexcept>
+#include <string>
+
+#if defined(__SIZEOF_INT128__)
+
+// Thrown by FixedDecimal when a result has more than Scale decimals or more
+// than Digits digits.
+class FixedDecimalInexact final : public std::range_error {
+public:
+    FixedDecimalInexact() : std::range_error("FixedDecimal: result not representable") {}
+};
+
+constexpr __int128 FixedDecimalPow10(int k) {
+    __int128 p = 1;
+    for (int i = 0; i < k; ++i)
+        p *= 10;
+    return p;
+}
+
+// A decimal with up to Digits digits, Scale of them after the point, held as
+// one 128-bit integer: the value is raw / 10^Scale. Arithmetic is exact or
+// throws FixedDecimalInexact; it never rounds. A computation that finishes
+// therefore has the value BigNumber or BigRational would give, and one
+// that throws can be redone with them. Division by zero throws
+// FixedDecimalInexact too, so the redo reports it. Everything but the
+// conversions is constexpr.
+template <int Digits, int Scale>
+class FixedDecimal final
+{
+    // Digits <= 36 leaves two spare digits in 128 bits for long division, and
+    // 2 * Scale <= 38 lets two fractional parts be multiplied directly.
+    static_assert(0 <= Scale && Scale <= Digits && Digits <= 36 && 2 * Scale <= 38,
+                  "FixedDecimal: unsupported Digits/Scale");
+
+public:
+    using Raw = __int128;
+
+    constexpr FixedDecimal() = default;
+    // Throws FixedDecimalInexact when value does not fit.
+    explicit FixedDecimal(const BigNumber& value);
+
+    // value = raw / 10^Scale.
+    static constexpr FixedDecimal FromRaw(Raw raw);
+    constexpr Raw RawValue() const { return raw_; }
+
+    BigNumber ToBigNumber() const { return BigNumber::FromScaledInteger(raw_, Scale); }
+    std::string ToStdString() const { return ToBigNumber().ToStdString(); }
+
+    constexpr bool IsZero() const { return raw_ == 0; }
+    constexpr bool IsNegative() const { return raw_ < 0; }
+
+    constexpr FixedDecimal& operator+=(const FixedDecimal& rhs);
+    constexpr FixedDecimal& operator-=(const FixedDecimal& rhs);
+    constexpr FixedDecimal& operator*=(const FixedDecimal& rhs);
+    constexpr FixedDecimal& operator/=(const FixedDecimal& rhs);
+
+    constexpr FixedDecimal operator+(const FixedDecimal& rhs) const { return FixedDecimal(*this) += rhs; }
+    constexpr FixedDecimal operator-(const FixedDecimal& rhs) const { return FixedDecimal(*this) -= rhs; }
+    constexpr FixedDecimal operator*(const FixedDecimal& rhs) const { return FixedDecimal(*this) *= rhs; }
+    constexpr FixedDecimal operator/(const FixedDecimal& rhs) const { return FixedDecimal(*this) /= rhs; }
+
+    constexpr FixedDecimal& Negate() {
+        raw_ = -raw_;
+        return *this;
+    }
+    constexpr FixedDecimal Percent() const;
+    constexpr FixedDecimal operator%(int /*percent_token*/) const { return Percent(); }
+
+    friend constexpr bool operator==(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ == b.raw_; }
+    friend constexpr bool operator!=(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ != b.raw_; }
+    friend constexpr bool operator<(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ < b.raw_; }
+    friend constexpr bool operator>(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ > b.raw_; }
+    friend constexpr bool operator<=(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ <= b.raw_; }
+    friend constexpr bool operator>=(const FixedDecimal& a, const FixedDecimal& b) { return a.raw_ >= b.raw_; }
+
+private:
+    Raw raw_ = 0;
+
+    static constexpr Raw kLimit = FixedDecimalPow10(Digits);
+    static constexpr Raw kOne = FixedDecimalPow10(Scale);
+    // Digits a remainder below kLimit can be shifted by without overflow.
+    static constexpr int kDivStep = 38 - Digits;
+
+    static constexpr Raw Checked(Raw raw) {
+        if (raw >= kLimit || raw <= -kLimit)
+            throw FixedDecimalInexact();
+        return raw;
+    }
+};
+
+template <int Digits, int Scale>
+FixedDecimal<Digits, Scale>::FixedDecimal(const BigNumber& value) {
+    if (!value.ToScaledInteger(Scale, Digits, &raw_))
+        throw FixedDecimalInexact();
+}
+
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale> FixedDecimal<Digits, Scale>::FromRaw(Raw raw) {
+    FixedDecimal out;
+    out.raw_ = Checked(raw);
+    return out;
+}
+
+// Operands are below 10^36, so neither sums nor differences can wrap.
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale>& FixedDecimal<Digits, Scale>::operator+=(
+        const FixedDecimal& rhs) {
+    raw_ = Checked(raw_ + rhs.raw_);
+    return *this;
+}
+
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale>& FixedDecimal<Digits, Scale>::operator-=(
+        const FixedDecimal& rhs) {
+    raw_ = Checked(raw_ - rhs.raw_);
+    return *this;
+}
+
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale>& FixedDecimal<Digits, Scale>::operator*=(
+        const FixedDecimal& rhs) {
+    // The result is raw_ * rhs.raw_ / 10^Scale, which must divide exactly.
+    Raw product = 0;
+    if (!__builtin_mul_overflow(raw_, rhs.raw_, &product)) {
+        if (product % kOne != 0)
+            throw FixedDecimalInexact();
+        raw_ = Checked(product / kOne);
+        return *this;
+    }
+
+    // The full product does not fit in 128 bits; split both operands into
+    // integer and fractional parts and add up the four partial products.
+    const Raw ai = raw_ / kOne, af = raw_ % kOne;
+    const Raw bi = rhs.raw_ / kOne, bf = rhs.raw_ % kOne;
+    const Raw fractions = af * bf;
+    if (fractions % kOne != 0)
+        throw FixedDecimalInexact();
+    Raw integers = 0;
+    if (__builtin_mul_overflow(ai, bi, &integers) ||
+        __builtin_mul_overflow(integers, kOne, &integers))
+        throw FixedDecimalInexact();
+    raw_ = Checked(Checked(Checked(integers + ai * bf) + af * bi) + fractions / kOne);
+    return *this;
+}
+
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale>& FixedDecimal<Digits, Scale>::operator/=(
+        const FixedDecimal& rhs) {
+    if (rhs.raw_ == 0)
+        throw FixedDecimalInexact();
+    const bool negative = (raw_ < 0) != (rhs.raw_ < 0);
+    const Raw a = raw_ < 0 ? -raw_ : raw_;
+    const Raw b = rhs.raw_ < 0 ? -rhs.raw_ : rhs.raw_;
+
+    // The result is a * 10^Scale / b. When a * 10^Scale fits that is one
+    // division; otherwise it is long division, kDivStep digits at a time.
+    Raw q = 0;
+    Raw r = 0;
+    Raw shifted = 0;
+    if (!__builtin_mul_overflow(a, kOne, &shifted)) {
+        q = shifted / b;
+        r = shifted % b;
+    } else {
+        q = a / b;
+        r = a % b;
+        for (int left = Scale; left > 0;) {
+            const int step = left < kDivStep ? left : kDivStep;
+            const Raw p = FixedDecimalPow10(step);
+            if (q >= kLimit / p)
+                throw FixedDecimalInexact();
+            r *= p;
+            q = q * p + r / b;
+            r %= b;
+            left -= step;
+        }
+    }
+    if (r != 0)
+        throw FixedDecimalInexact();
+    raw_ = Checked(negative ? -q : q);
+    return *this;
+}
+
+template <int Digits, int Scale>
+constexpr FixedDecimal<Digits, Scale> FixedDecimal<Digits, Scale>::Percent() const {
+    if (raw_ % 100 != 0)
+        throw FixedDecimalInexact();
+    FixedDecimal out;
+    out.raw_ = raw_ / 100;
+    return out;
+}
+
+#endif // __SIZEOF_INT128__
@@ -0,0 +1,53 @@
+// FixedDecimal against exact results: every expression it evaluates without
+// throwing FixedDecimalInexact must give exactly what BigRational gives.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "fixeddecimal.h"
+#include "formula.h"
+#include "testsupport.h"
+
+#include <random>
+#include <string>
+
+namespace {
+
+#if defined(__SIZEOF_INT128__)
+
+void TestFixedDecimal() {
+    using Interactive = FixedDecimal<30, 12>;
+    std::mt19937_64 rng(6);
+    int cases = 0, exact_cases = 0;
+    for (int i = 0; i < 3000; ++i) {
+        const Reference ref = RandomReference(rng, 4);
+        if (ref.overflow || !ref.value)
+            continue;
+        const Formula program = Formula::Compile(ref.text);
+        BigNumber fixed;
+        try {
+            fixed = program.Evaluate<Interactive>().ToBigNumber();
+        } catch (const FixedDecimalInexact&) {
+            ++cases;
+            continue;
+        }
+        const BigRational exact = program.Evaluate<BigRational>();
+        if (!(BigRational(fixed) - exact).IsZero())
+            Fail("fixed: " + ref.text + " gives " + fixed.ToStdString());
+        ++cases;
+        ++exact_cases;
+    }
+    if (exact_cases == 0)
+        Fail("fixed: no expression stayed on the fast path");
+    Report("fixed-decimal", cases, ", " + std::to_string(exact_cases) + " on the fast path");
+}
+
+#endif
+
+} // namespace
+
+int main() {
+#if defined(__SIZEOF_INT128__)
+    TestFixedDecimal();
+#endif
+    return ExitCode();
+}
@@ -0,0 +1,525 @@
+#include "formula.h"
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+
+enum class Prev {
+    kOperand,
+    kOperator,
+    kLParen,
+    kRParen,
+    kPercent
+};
+
+int Precedence(char op) {
+    if (op == '%' || op == '*' || op == '/') return 2;
+    if (op == '+' || op == '-') return 1;
+    return 0;
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool IsIdentifierStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool IsIdentifierChar(char c) {
+    return IsIdentifierStart(c) || IsDigit(c);
+}
+
+// Constant divisions are only folded when both operands are below
+// 10^kMaxFoldedDigits with at most kMaxFoldedDigits fractional digits.
+// Larger ones are left to Evaluate, where they cost no more, instead of
+// slowing down Compile.
+constexpr int kMaxFoldedDigits = 100;
+
+bool FitsFolding(const BigNumber& n) {
+    if (n.FractionalDigits() > kMaxFoldedDigits)
+        return false;
+    BigNumber magnitude = n;
+    if (magnitude.IsNegative())
+        magnitude.Negate();
+    return magnitude < BigNumber::Pow10(kMaxFoldedDigits);
+}
+
+// a / b as an exact decimal of at most kMaxFoldedDigits significant digits,
+// if there is one and its operands are small enough to be worth folding.
+bool ExactQuotient(const BigNumber& a, const BigNumber& b, BigNumber* q) {
+    return !b.IsZero() && FitsFolding(a) && FitsFolding(b) &&
+           BigNumber::DivideExactly(a, b, kMaxFoldedDigits, q);
+}
+
+} // namespace
+
+int Formula::SlotOf(std::string_view name) const {
+    const auto it = std::find(variables_.begin(), variables_.end(), name);
+    return (it == variables_.end()) ? -1 : static_cast<int>(it - variables_.begin());
+}
+
+// Appends an instruction, checking on the way that every operator will find
+// its operands, so Evaluate never has to.
+void Formula::Emit(OpCode op, std::uint32_t operand, std::size_t* depth) {
+    switch (op) {
+    case OpCode::kConstant:
+    case OpCode::kVariable:
+    case OpCode::kLoad:
+        max_depth_ = std::max(max_depth_, ++*depth);
+        break;
+    case OpCode::kPercent:
+        if (*depth < 1)
+            throw std::runtime_error("percent without operand");
+        break;
+    case OpCode::kNegate:
+        if (*depth < 1)
+            throw std::runtime_error("unary minus without operand");
+        break;
+    case OpCode::kStore:
+        if (*depth < 1)
+            throw std::runtime_error("assignment without value");
+        break;
+    default:
+        if (*depth < 2)
+            throw std::runtime_error("op without operands");
+        --*depth;
+        break;
+    }
+    code_.push_back({op, operand});
+}
+
+void Formula::EmitOperator(char op, std::size_t* depth) {
+    switch (op) {
+    case '+': Emit(OpCode::kAdd, 0, depth); break;
+    case '-': Emit(OpCode::kSubtract, 0, depth); break;
+    case '*': Emit(OpCode::kMultiply, 0, depth); break;
+    case '/': Emit(OpCode::kDivide, 0, depth); break;
+    case '%': Emit(OpCode::kPercent, 0, depth); break;
+    default: throw std::runtime_error("mismatched parens");
+    }
+}
+
+// Shunting-yard straight into bytecode: operands are emitted as they are
+// read, operators once precedence allows. % is postfix and binds like * and
+// /, but right-associatively.
+Formula Formula::Compile(std::string_view expr, bool optimize) {
+    Formula out;
+    std::vector<char> ops;
+    std::size_t depth = 0;
+    Prev prev = Prev::kOperator;
+    std::size_t i = 0;
+
+    const auto push_operator = [&](char op) {
+        const bool left_assoc = (op != '%');
+        while (!ops.empty() && ops.back() != '(') {
+            const int p1 = Precedence(op);
+            const int p2 = Precedence(ops.back());
+            if (!((left_assoc && p1 <= p2) || (!left_assoc && p1 < p2)))
+                break;
+            out.EmitOperator(ops.back(), &depth);
+            ops.pop_back();
+        }
+        ops.push_back(op);
+    };
+
+    while (i < expr.size()) {
+        const char c = expr[i];
+        if (std::isspace(static_cast<unsigned char>(c)) || c == '=') {
+            ++i;
+            continue;
+        }
+
+        if (c == '(') {
+            ops.push_back('(');
+            prev = Prev::kLParen;
+            ++i;
+            continue;
+        }
+
+        if (c == ')') {
+            while (!ops.empty() && ops.back() != '(') {
+                out.EmitOperator(ops.back(), &depth);
+                ops.pop_back();
+            }
+            if (ops.empty())
+                throw std::runtime_error("mismatched parens");
+            ops.pop_back();
+            prev = Prev::kRParen;
+            ++i;
+            continue;
+        }
+
+        if (c == '%') {
+            push_operator('%');
+            prev = Prev::kPercent;
+            ++i;
+            continue;
+        }
+
+        const bool unary_minus =
+            (c == '-') &&
+            (prev == Prev::kOperator || prev == Prev::kLParen || prev == Prev::kPercent);
+
+        if ((c == '+' || c == '-' || c == '*' || c == '/') && !unary_minus) {
+            push_operator(c);
+            prev = Prev::kOperator;
+            ++i;
+            continue;
+        }
+
+        if (unary_minus && i + 1 < expr.size() && IsIdentifierStart(expr[i + 1])) {
+            ++i;
+            // Falls through to the identifier below, negated once pushed.
+        } else if (IsDigit(c) || c == '.' || c == '-') {
+            const std::size_t start = i;
+            bool seen_dot = false;
+            bool seen_digit = false;
+
+            if (expr[i] == '-')
+                ++i;
+
+            while (i < expr.size()) {
+                const char ch = expr[i];
+                if (IsDigit(ch)) {
+                    seen_digit = true;
+                    ++i;
+                    continue;
+                }
+                if (ch == '.' && !seen_dot) {
+                    seen_dot = true;
+                    ++i;
+                    continue;
+                }
+                break;
+            }
+
+            if (!seen_digit)
+                throw std::runtime_error("bad number");
+
+            // The token is parsed where it stands in the source text.
+            out.constants_.emplace_back(expr.substr(start, i - start));
+            out.Emit(OpCode::kConstant,
+                     static_cast<std::uint32_t>(out.constants_.size() - 1), &depth);
+            prev = Prev::kOperand;
+            continue;
+        }
+
+        if (IsIdentifierStart(expr[i])) {
+            const std::size_t start = i;
+            while (i < expr.size() && IsIdentifierChar(expr[i]))
+                ++i;
+
+            const std::string_view name = expr.substr(start, i - start);
+            int slot = out.SlotOf(name);
+            if (slot < 0) {
+                out.variables_.emplace_back(name);
+                slot = static_cast<int>(out.variables_.size() - 1);
+            }
+            out.Emit(OpCode::kVariable, static_cast<std::uint32_t>(slot), &depth);
+            if (unary_minus)
+                out.Emit(OpCode::kNegate, 0, &depth);
+            prev = Prev::kOperand;
+            continue;
+        }
+
+        throw std::runtime_error("unknown token");
+    }
+
+    while (!ops.empty()) {
+        out.EmitOperator(ops.back(), &depth);
+        ops.pop_back();
+    }
+
+    if (depth != 1)
+        throw std::runtime_error("bad expression");
+
+    if (optimize)
+        out.Optimize();
+    return out;
+}
+
+// Replays the bytecode into a hash-consed expression DAG, so equal subtrees
+// share one node, simplifying each node as it is built. The DAG is then
+// emitted again in evaluation order; a non-leaf node with several parents is
+// stored to a temporary the first time and loaded after that.
+void Formula::Optimize() {
+    struct Node {
+        OpCode op;
+        std::uint32_t operand;
+        int lhs;
+        int rhs;
+    };
+
+    std::vector<Node> nodes;
+    std::map<std::tuple<OpCode, std::uint32_t, int, int>, int> interned;
+    std::vector<BigNumber> constants;
+    std::unordered_map<BigNumber, std::uint32_t> constant_slots;
+
+    const auto make = [&](OpCode op, std::uint32_t operand, int lhs, int rhs) {
+        const auto [it, inserted] = interned.emplace(
+            std::make_tuple(op, operand, lhs, rhs), static_cast<int>(nodes.size()));
+        if (inserted)
+            nodes.push_back({op, operand, lhs, rhs});
+        return it->second;
+    };
+    const auto constant = [&](const BigNumber& value) {
+        const auto [it, inserted] = constant_slots.emplace(
+            value, static_cast<std::uint32_t>(constants.size()));
+        if (inserted)
+            constants.push_back(value);
+        return make(OpCode::kConstant, it->second, -1, -1);
+    };
+    const auto value_of = [&](int n) -> const BigNumber* {
+        return nodes[n].op == OpCode::kConstant ? &constants[nodes[n].operand] : nullptr;
+    };
+    const auto is = [&](int n, const BigNumber& v) {
+        const BigNumber* c = value_of(n);
+        return c && *c == v;
+    };
+
+    const BigNumber zero = BigNumber::Zero();
+    const BigNumber one = BigNumber::One();
+    const BigNumber minus_one = BigNumber::Zero() - one;
+
+    const auto negate = [&](int n) {
+        if (const BigNumber* c = value_of(n))
+            return constant(BigNumber(*c).Negate());
+        if (nodes[n].op == OpCode::kNegate)
+            return nodes[n].lhs;
+        return make(OpCode::kNegate, 0, n, -1);
+    };
+
+    const auto percent = [&](int n) {
+        if (const BigNumber* c = value_of(n))
+            return constant(c->Percent());
+        return make(OpCode::kPercent, 0, n, -1);
+    };
+
+    int folded_digits = 0;
+    const auto binary = [&](OpCode op, int a, int b) {
+        const BigNumber* ca = value_of(a);
+        const BigNumber* cb = value_of(b);
+        if (ca && cb) {
+            switch (op) {
+            case OpCode::kAdd:
+                return constant(*ca + *cb);
+            case OpCode::kSubtract:
+                return constant(*ca - *cb);
+            case OpCode::kMultiply:
+                return constant(*ca * *cb);
+            case OpCode::kDivide: {
+                BigNumber q;
+                if (ExactQuotient(*ca, *cb, &q)) {
+                    folded_digits = std::max(folded_digits, q.SignificantDigits());
+                    return constant(q);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        // Subtrees are never dropped (x*0 stays), since evaluating them may
+        // throw, e.g. on a division by zero.
+        switch (op) {
+        case OpCode::kAdd:
+            if (is(b, zero)) return a;
+            if (is(a, zero)) return b;
+            break;
+        case OpCode::kSubtract:
+            if (is(b, zero)) return a;
+            if (is(a, zero)) return negate(b);
+            break;
+        case OpCode::kMultiply:
+            if (is(b, one)) return a;
+            if (is(a, one)) return b;
+            if (is(b, minus_one)) return negate(a);
+            if (is(a, minus_one)) return negate(b);
+            break;
+        default:
+            // x/1 is kept: under BigNumber it rounds x to the context.
+            break;
+        }
+        return make(op, 0, a, b);
+    };
+
+    std::vector<int> stack;
+    for (const Instruction& in : code_) {
+        switch (in.op) {
+        case OpCode::kConstant:
+            stack.push_back(constant(constants_[in.operand]));
+            break;
+        case OpCode::kVariable:
+            stack.push_back(make(OpCode::kVariable, in.operand, -1, -1));
+            break;
+        case OpCode::kNegate:
+            stack.back() = negate(stack.back());
+            break;
+        case OpCode::kPercent:
+            stack.back() = percent(stack.back());
+            break;
+        case OpCode::kStore:
+        case OpCode::kLoad:
+            throw std::logic_error("Formula: already optimized");
+        default: {
+            const int rhs = stack.back();
+            stack.pop_back();
+            stack.back() = binary(in.op, stack.back(), rhs);
+            break;
+        }
+        }
+    }
+
+    // Children are always created before their parents, so one pass from
+    // the root downwards counts the uses of every reachable node.
+    const int root = stack.back();
+    std::vector<int> uses(nodes.size(), 0);
+    std::vector<bool> reachable(nodes.size(), false);
+    reachable[root] = true;
+    for (int n = root; n >= 0; --n) {
+        if (!reachable[n])
+            continue;
+        for (int child : {nodes[n].lhs, nodes[n].rhs}) {
+            if (child >= 0) {
+                reachable[child] = true;
+                ++uses[child];
+            }
+        }
+    }
+
+    // A narrower context would have rounded one of the folded quotients, so
+    // Evaluate keeps the original program for it.
+    if (folded_digits > 0) {
+        unfolded_ = std::make_shared<const Formula>(*this);
+        folded_digits_ = folded_digits;
+    }
+
+    // Only constants reachable from the root are kept.
+    std::vector<BigNumber> kept_constants;
+    std::vector<std::int64_t> constant_remap(constants.size(), -1);
+
+    code_.clear();
+    max_depth_ = 0;
+    temp_count_ = 0;
+    std::size_t depth = 0;
+    std::vector<std::int64_t> temp_of(nodes.size(), -1);
+
+    const auto emit = [&](const auto& self, int n) -> void {
+        const Node& node = nodes[n];
+        if (temp_of[n] >= 0) {
+            Emit(OpCode::kLoad, static_cast<std::uint32_t>(temp_of[n]), &depth);
+            return;
+        }
+        if (node.op == OpCode::kConstant) {
+            std::int64_t& slot = constant_remap[node.operand];
+            if (slot < 0) {
+                slot = static_cast<std::int64_t>(kept_constants.size());
+                kept_constants.push_back(constants[node.operand]);
+            }
+            Emit(OpCode::kConstant, static_cast<std::uint32_t>(slot), &depth);
+            return;
+        }
+        if (node.lhs >= 0)
+            self(self, node.lhs);
+        if (node.rhs >= 0)
+            self(self, node.rhs);
+        Emit(node.op, node.operand, &depth);
+        if (uses[n] > 1 && node.op != OpCode::kVariable) {
+            temp_of[n] = static_cast<std::int64_t>(temp_count_++);
+            Emit(OpCode::kStore, static_cast<std::uint32_t>(temp_of[n]), &depth);
+        }
+    };
+    emit(emit, root);
+
+    constants_ = std::move(kept_constants);
+}
+
+std::string Formula::Dump() const {
+    std::string out;
+    for (std::size_t i = 0; i < code_.size(); ++i) {
+        const Instruction& in = code_[i];
+        out += std::to_string(i);
+        out += ": ";
+        switch (in.op) {
+        case OpCode::kConstant:
+            out += "const " + constants_[in.operand].ToStdString();
+            break;
+        case OpCode::kVariable:
+            out += "var " + variables_[in.operand];
+            break;
+        case OpCode::kAdd:
+            out += "add";
+            break;
+        case OpCode::kSubtract:
+            out += "sub";
+            break;
+        case OpCode::kMultiply:
+            out += "mul";
+            break;
+        case OpCode::kDivide:
+            out += "div";
+            break;
+        case OpCode::kPercent:
+            out += "percent";
+            break;
+        case OpCode::kNegate:
+            out += "neg";
+            break;
+        case OpCode::kStore:
+            out += "store t" + std::to_string(in.operand);
+            break;
+        case OpCode::kLoad:
+            out += "load t" + std::to_string(in.operand);
+            break;
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+std::string Formula::CanonicalText() const {
+    std::string out;
+    for (const Instruction& in : code_) {
+        if (!out.empty())
+            out += ' ';
+        switch (in.op) {
+        case OpCode::kConstant:
+            out += constants_[in.operand].ToStdString();
+            break;
+        case OpCode::kVariable:
+            out += variables_[in.operand];
+            break;
+        case OpCode::kAdd:
+            out += '+';
+            break;
+        case OpCode::kSubtract:
+            out += '-';
+            break;
+        case OpCode::kMultiply:
+            out += '*';
+            break;
+        case OpCode::kDivide:
+            out += '/';
+            break;
+        case OpCode::kPercent:
+            out += '%';
+            break;
+        case OpCode::kNegate:
+            out += '~';
+            break;
+        case OpCode::kStore:
+            out += '>' + std::to_string(in.operand);
+            break;
+        case OpCode::kLoad:
+            out += '<' + std::to_string(in.operand);
+            break;
+        }
+    }
+    return out;
+}
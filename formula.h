@@ -0,0 +1,143 @@
+#pragma once
+
+#include "bignumber.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// An arithmetic expression compiled once into stack bytecode, so it can be
+// evaluated many times with different variable bindings without parsing it
+// again. The syntax is the calculator's: decimal numbers, + - * /, postfix
+// %, parentheses, and variables named [A-Za-z_][A-Za-z0-9_]*. A '-' where
+// no binary operator can stand belongs to the number or variable after it.
+class Formula final
+{
+public:
+    // Throws std::runtime_error for malformed expressions and
+    // std::invalid_argument for malformed numbers. Unless told otherwise the
+    // program is optimized: constant subtrees are folded, identities such as
+    // x*1 and x+0 are dropped, and a repeated subexpression is computed once
+    // and reloaded from a temporary. A constant division is folded only when
+    // its quotient is an exact decimal; BigNumber evaluation under a context
+    // too narrow to hold every such quotient runs the unoptimized program,
+    // so the result never depends on whether the program was optimized.
+    static Formula Compile(std::string_view expr, bool optimize = true);
+
+    // One instruction per line, for checking what the optimizer produced.
+    std::string Dump() const;
+    // The program in postfix on one line. Expressions that differ only in
+    // whitespace, redundant parentheses or the spelling of their numbers
+    // compile to the same text, so it can key a result cache.
+    std::string CanonicalText() const;
+
+    // Variable names indexed by slot, in order of first appearance.
+    const std::vector<std::string>& Variables() const { return variables_; }
+    // Slot of the named variable, or -1 when the expression does not use it.
+    int SlotOf(std::string_view name) const;
+
+    // Evaluates with variables[slot] bound to each slot. Value is BigNumber
+    // or BigRational, and division follows that type's rules.
+    template <typename Value>
+    Value Evaluate(const std::vector<Value>& variables = {}) const;
+
+private:
+    enum class OpCode : std::uint8_t {
+        kConstant,
+        kVariable,
+        kAdd,
+        kSubtract,
+        kMultiply,
+        kDivide,
+        kPercent,
+        kNegate,
+        kStore,
+        kLoad
+    };
+
+    struct Instruction {
+        OpCode op;
+        std::uint32_t operand;
+    };
+
+    std::vector<Instruction> code_;
+    std::vector<BigNumber> constants_;
+    std::vector<std::string> variables_;
+    std::size_t max_depth_ = 0;
+    std::size_t temp_count_ = 0;
+    // Significant digits of the longest folded quotient, and the program as
+    // it was before folding; both are unset when no division was folded.
+    int folded_digits_ = 0;
+    std::shared_ptr<const Formula> unfolded_;
+
+    void Emit(OpCode op, std::uint32_t operand, std::size_t* depth);
+    void EmitOperator(char op, std::size_t* depth);
+    void Optimize();
+};
+
+template <typename Value>
+Value Formula::Evaluate(const std::vector<Value>& variables) const {
+    if (variables.size() < variables_.size())
+        throw std::invalid_argument("Formula: unbound variable");
+    if constexpr (std::is_same_v<Value, BigNumber>) {
+        if (unfolded_ && BigNumber::GetContext().digits < folded_digits_)
+            return unfolded_->Evaluate(variables);
+    }
+
+    std::vector<Value> stack;
+    stack.reserve(max_depth_);
+    std::vector<Value> temps(temp_count_);
+
+    for (const Instruction& in : code_) {
+        switch (in.op) {
+        case OpCode::kConstant:
+            stack.emplace_back(constants_[in.operand]);
+            continue;
+        case OpCode::kVariable:
+            stack.push_back(variables[in.operand]);
+            continue;
+        case OpCode::kNegate:
+            stack.back().Negate();
+            continue;
+        case OpCode::kPercent:
+            stack.back() = stack.back().Percent();
+            continue;
+        case OpCode::kStore:
+            temps[in.operand] = stack.back();
+            continue;
+        case OpCode::kLoad:
+            stack.push_back(temps[in.operand]);
+            continue;
+        default:
+            break;
+        }
+
+        Value rhs = std::move(stack.back());
+        stack.pop_back();
+        Value& lhs = stack.back();
+        switch (in.op) {
+        case OpCode::kAdd:
+            lhs += rhs;
+            break;
+        case OpCode::kSubtract:
+            lhs -= rhs;
+            break;
+        case OpCode::kMultiply:
+            lhs *= rhs;
+            break;
+        case OpCode::kDivide:
+            lhs /= rhs;
+            break;
+        default:
+            throw std::logic_error("Formula: bad opcode");
+        }
+    }
+
+    return std::move(stack.back());
+}
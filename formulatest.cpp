@@ -0,0 +1,250 @@
+// Formula against the same expressions written out: programs compiled once
+// and evaluated with variable bindings, and optimized programs against
+// unoptimized ones.
+
+#include "bignumber.h"
+#include "bigrational.h"
+#include "formula.h"
+#include "testsupport.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::string Describe(const std::exception& e) {
+    return std::string("error: ") + e.what();
+}
+
+// --- Bytecode and variables ------------------------------------------------
+
+// text with every x and y replaced by the given numbers.
+std::string Substitute(std::string_view text, const std::string& x, const std::string& y) {
+    std::string out;
+    for (char c : text) {
+        if (c == 'x')
+            out += "(" + x + ")";
+        else if (c == 'y')
+            out += y;
+        else
+            out += c;
+    }
+    return out;
+}
+
+template <typename Value>
+std::string EvaluateBound(const Formula& program, const std::string& x, const std::string& y) {
+    std::vector<Value> variables(program.Variables().size());
+    for (std::size_t slot = 0; slot < variables.size(); ++slot)
+        variables[slot] = Value(program.Variables()[slot] == "x" ? x : y);
+    try {
+        return program.Evaluate(variables).ToStdString();
+    } catch (const std::exception& e) {
+        return Describe(e);
+    }
+}
+
+template <typename Value>
+std::string EvaluateText(const std::string& text) {
+    try {
+        return Formula::Compile(text, false).Evaluate<Value>().ToStdString();
+    } catch (const std::exception& e) {
+        return Describe(e);
+    }
+}
+
+// One program per expression, evaluated under several bindings, must give
+// what compiling the expression with the numbers written in gives. y only
+// takes positive values, since it follows a sign in some expressions.
+void TestVariables() {
+    const char* const kExpressions[] = {
+        "x+y", "x*-y/3", "(x-y)%", "x/(y-7)", "x*x*x-y", "((x+1)*(y-2))/(x-y)",
+        "-y-x%", "y/x/x", "x*(y+0.5)*x/(y*y)", "100-x%*y"};
+    const char* const kX[] = {"2.5", "-3", "0", "123456789.123", "-0.0001"};
+    const char* const kY[] = {"7", "0.001", "40", "1000000000000000000000000000000"};
+
+    int cases = 0;
+    for (const char* text : kExpressions) {
+        const Formula program = Formula::Compile(text, false);
+        for (const char* x : kX) {
+            for (const char* y : kY) {
+                const std::string written = Substitute(text, x, y);
+                const std::string decimal = EvaluateBound<BigNumber>(program, x, y);
+                const std::string want = EvaluateText<BigNumber>(written);
+                if (decimal != want)
+                    Fail(std::string("variables: ") + text + " with x=" + x + ", y=" + y +
+                         " gives " + decimal + ", written out " + want);
+                const std::string exact = EvaluateBound<BigRational>(program, x, y);
+                if (exact != EvaluateText<BigRational>(written))
+                    Fail(std::string("variables, exact: ") + text + " with x=" + x + ", y=" + y);
+                cases += 2;
+            }
+        }
+    }
+
+    const Formula program = Formula::Compile("rate*years - fee + rate", false);
+    if (program.Variables() != std::vector<std::string>{"rate", "years", "fee"} ||
+        program.SlotOf("years") != 1 || program.SlotOf("x") != -1)
+        Fail("variables: slots are not in order of first appearance");
+    try {
+        program.Evaluate<BigNumber>({BigNumber("1"), BigNumber("2")});
+        Fail("variables: a missing binding did not throw");
+    } catch (const std::invalid_argument&) {
+    }
+    cases += 2;
+    Report("variables", cases);
+}
+
+void TestMalformed() {
+    const char* const kMalformed[] = {"1+", "(1", "*2", "1)", "", "x y", "2(3)", "%", "1.2.3",
+                                      "--1", "1e"};
+    int cases = 0;
+    for (const char* text : kMalformed) {
+        try {
+            Formula::Compile(text);
+            Fail(std::string("malformed: \"") + text + "\" compiled");
+        } catch (const std::runtime_error&) {
+        } catch (const std::invalid_argument&) {
+        }
+        ++cases;
+    }
+    Report("malformed", cases);
+}
+
+// --- Optimizer: folding and shared subexpressions --------------------------
+
+// Random expressions over + - * / %, parentheses, signed numbers and two
+// variables. Subexpressions are reused now and then so the optimizer finds
+// something to share, and divisors are often powers of 2 and 5 so it finds
+// exact quotients to fold.
+class ExpressionGenerator final {
+public:
+    explicit ExpressionGenerator(std::uint64_t seed) : rng_(seed) {}
+
+    std::string Next() {
+        reuse_.clear();
+        return Expression(4);
+    }
+
+private:
+    std::mt19937_64 rng_;
+    std::vector<std::string> reuse_;
+
+    std::string Leaf() {
+        static const char* const kNumbers[] = {
+            "0", "1", "2", "3", "7", "10", "0.5", "0.125", "2.5", "1024",
+            "625", "0.0016", "40", "999", "123.456", "0.1", "3.75", "8", "1000"};
+        switch (rng_() % 6) {
+        case 0:
+            return (rng_() % 2) ? "x" : "-y";
+        case 1:
+            return RandomDigits(rng_, 1 + rng_() % 12);
+        case 2:
+            return "-" + std::string(kNumbers[rng_() % std::size(kNumbers)]);
+        default:
+            return kNumbers[rng_() % std::size(kNumbers)];
+        }
+    }
+
+    std::string Expression(int depth) {
+        if (!reuse_.empty() && rng_() % 5 == 0)
+            return reuse_[rng_() % reuse_.size()];
+        if (depth == 0 || rng_() % 4 == 0)
+            return Leaf();
+
+        static const char kOps[] = "+-*/";
+        std::string text = "(" + Expression(depth - 1) + kOps[rng_() % 4] +
+                           Expression(depth - 1) + ")";
+        // Parenthesized, since the tokenizer reads a '-' after '%' as a sign.
+        if (rng_() % 6 == 0)
+            text = "(" + text + "%)";
+        reuse_.push_back(text);
+        return text;
+    }
+};
+
+// The optimized program must give what the unoptimized one gives, to the
+// digit and the error message, under every context and in exact mode.
+void TestOptimizerMatchesUnoptimized() {
+    const BigNumber::RoundingMode kModes[] = {
+        BigNumber::RoundingMode::kHalfEven, BigNumber::RoundingMode::kHalfUp,
+        BigNumber::RoundingMode::kTruncate, BigNumber::RoundingMode::kFloor,
+        BigNumber::RoundingMode::kCeiling};
+    const int kDigits[] = {1, 3, 7, 30, 80};
+    const std::string x = "2.5", y = "-7";
+
+    ExpressionGenerator generator(1);
+    int cases = 0;
+    for (int i = 0; i < 400; ++i) {
+        const std::string text = generator.Next();
+        const Formula optimized = Formula::Compile(text);
+        const Formula plain = Formula::Compile(text, false);
+        for (int digits : kDigits) {
+            for (BigNumber::RoundingMode mode : kModes) {
+                const BigNumber::ScopedContext context({digits, mode});
+                const std::string want = EvaluateBound<BigNumber>(plain, x, y);
+                const std::string got = EvaluateBound<BigNumber>(optimized, x, y);
+                if (got != want) {
+                    Fail("optimizer, " + std::to_string(digits) + " digits: " + text +
+                         " gives " + got + ", unoptimized " + want);
+                }
+                ++cases;
+            }
+        }
+        if (EvaluateBound<BigRational>(optimized, x, y) != EvaluateBound<BigRational>(plain, x, y))
+            Fail("optimizer, exact: " + text);
+        ++cases;
+    }
+
+    // Folded quotients that a narrow context rounds.
+    const BigNumber::ScopedContext context({3, BigNumber::RoundingMode::kHalfEven});
+    const std::pair<const char*, const char*> kRounded[] = {
+        {"1/1024", "0.000977"}, {"1/1000/1024", "0.000000977"}, {"1/1024*1024", "1.000448"}};
+    for (const auto& [text, want] : kRounded) {
+        const std::string got = Formula::Compile(text).Evaluate<BigNumber>().ToStdString();
+        if (got != want)
+            Fail(std::string("optimizer: ") + text + " gives " + got + ", expected " + want);
+        ++cases;
+    }
+    Report("optimizer", cases);
+}
+
+// What the optimizer leaves of a few expressions: constants folded, x*1
+// and x+0 dropped, exact quotients folded but inexact ones and x/1 kept
+// for the context to round, and a repeated subexpression stored once.
+void TestOptimizedPrograms() {
+    const std::pair<const char*, const char*> kPrograms[] = {
+        {"2*3+x*1+0", "6 x +"},
+        {"10%*x", "0.1 x *"},
+        {"1/1024*x", "0.0009765625 x *"},
+        {"1/3*x", "1 3 / x *"},
+        {"x/1", "x 1 /"},
+        {"(x*y+1)*(x*y+1)", "x y * 1 + >0 <0 *"},
+        {"(x+y)/(x+y)-(x+y)", "x y + >0 <0 / <0 -"}};
+    int cases = 0;
+    for (const auto& [text, want] : kPrograms) {
+        const std::string got = Formula::Compile(text).CanonicalText();
+        if (got != want)
+            Fail(std::string("optimizer: ") + text + " compiles to " + got + ", expected " + want);
+        ++cases;
+    }
+    Report("optimized-programs", cases);
+}
+
+} // namespace
+
+int main() {
+    TestVariables();
+    TestMalformed();
+    TestOptimizerMatchesUnoptimized();
+    TestOptimizedPrograms();
+    return ExitCode();
+}
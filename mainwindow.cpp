@@ -55,6 +55,25 @@ MainWindow::MainWindow(QWidget *parent)
                 ui_->lbl_expression->setText(FormatWithSpaces(text, 37));
             });
 
+    const auto show_preview = [this](const QString& text) {
+        ui_->lbl_preview->setText(text.isEmpty() ? text : "= " + text);
+    };
+    connect(model_.get(), &CalculatorModel::PreviewChanged, this, show_preview);
+
+    connect(model_.get(), &CalculatorModel::ComputingChanged, this,
+            [this, show_preview](bool computing) {
+                if (computing)
+                    ui_->lbl_preview->setText(QStringLiteral("Computing…"));
+                else
+                    show_preview(model_->Preview());
+            });
+
+    connect(model_.get(), &CalculatorModel::ProgressChanged, this,
+            [this](int percent) {
+                ui_->lbl_preview->setText(
+                    QStringLiteral("Computing… %1%").arg(percent));
+            });
+
     equal_long_press_timer_->setSingleShot(true);
     equal_long_press_timer_->setInterval(4000);
 
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Evaluates an expression while it is being typed. Operands and operators
+// arrive one at a time and are reduced as soon as precedence allows, so the
+// stacks only hold what is still waiting for a right operand: at most two
+// operators per open parenthesis. A keystroke therefore costs the same
+// however long the expression already is. Value is BigNumber or
+// BigRational, as in Formula::Evaluate, or the CertifiedDouble filter.
+template <typename Value>
+class PreviewEvaluator final
+{
+public:
+    void Reset();
+
+    // The operand being typed. Called again on every change to it; the
+    // operator before it is committed on the first call only.
+    void SetOperand(const Value& value);
+    void SetOperandText(std::string_view text) { SetOperand(Value(text)); }
+    // A binary operator typed after a complete operand. Typing another one
+    // straight after replaces it.
+    void SetOperator(char op);
+    void OpenParen();
+    void CloseParen();
+    void Percent();
+    // Stops previewing until the next Reset, for input that cannot be
+    // followed incrementally.
+    void Invalidate() { valid_ = false; }
+
+    // The value of what has been typed so far, with open parentheses closed
+    // and a trailing operator ignored. False when there is nothing to show
+    // or it cannot be computed, e.g. after a division by zero.
+    bool Preview(Value* out) const;
+
+private:
+    // Left operands, one for every binary operator in ops_.
+    std::vector<Value> operands_;
+    // Binary operators and '(' still waiting for their right side.
+    std::vector<char> ops_;
+    std::optional<Value> current_;
+    // Operator typed after the last operand but not yet committed to ops_.
+    char pending_op_ = 0;
+    bool valid_ = true;
+
+    static int Precedence(char op) { return (op == '*' || op == '/') ? 2 : 1; }
+    static void Apply(Value& lhs, char op, const Value& rhs);
+    void CommitPendingOperator();
+};
+
+template <typename Value>
+void PreviewEvaluator<Value>::Reset() {
+    operands_.clear();
+    ops_.clear();
+    current_.reset();
+    pending_op_ = 0;
+    valid_ = true;
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::Apply(Value& lhs, char op, const Value& rhs) {
+    switch (op) {
+    case '+': lhs += rhs; break;
+    case '-': lhs -= rhs; break;
+    case '*': lhs *= rhs; break;
+    case '/': lhs /= rhs; break;
+    default: throw std::logic_error("PreviewEvaluator: bad operator");
+    }
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::CommitPendingOperator() {
+    if (pending_op_ == 0)
+        return;
+    try {
+        while (!ops_.empty() && ops_.back() != '(' &&
+               Precedence(ops_.back()) >= Precedence(pending_op_)) {
+            Value rhs = std::move(operands_.back());
+            operands_.pop_back();
+            Apply(operands_.back(), ops_.back(), rhs);
+            ops_.pop_back();
+        }
+    } catch (const std::exception&) {
+        valid_ = false;
+    }
+    ops_.push_back(pending_op_);
+    pending_op_ = 0;
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::SetOperand(const Value& value) {
+    if (!valid_)
+        return;
+    CommitPendingOperator();
+    current_ = value;
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::SetOperator(char op) {
+    if (!valid_)
+        return;
+    if (current_) {
+        operands_.push_back(std::move(*current_));
+        current_.reset();
+        pending_op_ = op;
+    } else if (pending_op_ != 0) {
+        pending_op_ = op;
+    }
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::OpenParen() {
+    if (!valid_)
+        return;
+    CommitPendingOperator();
+    ops_.push_back('(');
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::CloseParen() {
+    if (!valid_)
+        return;
+    if (!current_) {
+        valid_ = false;
+        return;
+    }
+    try {
+        while (!ops_.empty() && ops_.back() != '(') {
+            Value lhs = std::move(operands_.back());
+            operands_.pop_back();
+            Apply(lhs, ops_.back(), *current_);
+            current_ = std::move(lhs);
+            ops_.pop_back();
+        }
+    } catch (const std::exception&) {
+        valid_ = false;
+        return;
+    }
+    if (!ops_.empty())
+        ops_.pop_back();
+}
+
+template <typename Value>
+void PreviewEvaluator<Value>::Percent() {
+    if (valid_ && current_)
+        current_ = current_->Percent();
+}
+
+template <typename Value>
+bool PreviewEvaluator<Value>::Preview(Value* out) const {
+    if (!valid_)
+        return false;
+
+    std::size_t k = operands_.size();
+    Value v;
+    if (current_)
+        v = *current_;
+    else if (pending_op_ != 0 && k > 0)
+        v = operands_[--k];
+    else
+        return false;
+
+    try {
+        for (std::size_t i = ops_.size(); i-- > 0;) {
+            if (ops_[i] == '(')
+                continue;
+            Value lhs = operands_[--k];
+            Apply(lhs, ops_[i], v);
+            v = std::move(lhs);
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    *out = std::move(v);
+    return true;
+}
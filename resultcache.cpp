@@ -0,0 +1,74 @@
+#include "resultcache.h"
+
+namespace {
+
+// Rough per-entry cost of the list node, the hash node and the string and
+// number headers, on top of the characters and digits themselves.
+constexpr std::size_t kEntryOverhead = 192;
+
+} // namespace
+
+ResultCache::ResultCache(std::size_t max_bytes) : max_bytes_(max_bytes) {}
+
+std::size_t ResultCache::EntryBytes(const std::string& key, const Result& result) {
+    // Limbs hold nine digits in four bytes.
+    return kEntryOverhead + key.size() +
+           static_cast<std::size_t>(result.text.size()) * sizeof(QChar) +
+           static_cast<std::size_t>(result.value.Digits()) / 2;
+}
+
+const ResultCache::Result* ResultCache::Find(const std::string& key) {
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    ++stats_.hits;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+}
+
+void ResultCache::Insert(const std::string& key, const Result& result) {
+    const std::size_t bytes = EntryBytes(key, result);
+    if (bytes > max_bytes_)
+        return;
+
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+        stats_.bytes -= EntryBytes(it->second->first, it->second->second);
+        it->second->second = result;
+        stats_.bytes += bytes;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        EvictToFit(max_bytes_);
+        return;
+    }
+
+    EvictToFit(max_bytes_ - bytes);
+    entries_.emplace_front(key, result);
+    index_.emplace(entries_.front().first, entries_.begin());
+    stats_.bytes += bytes;
+    stats_.entries = entries_.size();
+}
+
+void ResultCache::Clear() {
+    index_.clear();
+    entries_.clear();
+    stats_.bytes = 0;
+    stats_.entries = 0;
+}
+
+void ResultCache::SetMaxBytes(std::size_t max_bytes) {
+    max_bytes_ = max_bytes;
+    EvictToFit(max_bytes_);
+}
+
+void ResultCache::EvictToFit(std::size_t max_bytes) {
+    while (!entries_.empty() && stats_.bytes > max_bytes) {
+        const Entry& victim = entries_.back();
+        stats_.bytes -= EntryBytes(victim.first, victim.second);
+        index_.erase(victim.first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+    stats_.entries = entries_.size();
+}
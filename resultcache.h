@@ -0,0 +1,58 @@
+#pragma once
+
+#include "bigrational.h"
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Least-recently-used map from a canonical expression key to its result,
+// bounded by an approximate memory budget rather than an entry count.
+class ResultCache final
+{
+public:
+    // The text shown for the result and its exact value.
+    struct Result {
+        QString text;
+        BigRational value;
+    };
+
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+    };
+
+    explicit ResultCache(std::size_t max_bytes);
+
+    // Returns the cached result and marks it most recently used, or nullptr.
+    // The pointer stays valid until the next Insert or Clear.
+    const Result* Find(const std::string& key);
+    // Entries larger than the whole budget are not stored.
+    void Insert(const std::string& key, const Result& result);
+    void Clear();
+
+    Stats GetStats() const { return stats_; }
+    std::size_t MaxBytes() const { return max_bytes_; }
+    void SetMaxBytes(std::size_t max_bytes);
+
+private:
+    using Entry = std::pair<std::string, Result>;
+
+    // Front is the most recently used entry. The index keys view the
+    // strings stored in the list nodes, which never move.
+    std::list<Entry> entries_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+    std::size_t max_bytes_;
+    Stats stats_;
+
+    static std::size_t EntryBytes(const std::string& key, const Result& result);
+    void EvictToFit(std::size_t max_bytes);
+};
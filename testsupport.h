@@ -0,0 +1,181 @@
+#pragma once
+
+// Helpers shared by the engine tests. Each test is its own executable that
+// runs a handful of randomized checks against reference results and returns
+// ExitCode(); run them through ctest.
+
+#include "bignumber.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+
+inline int g_failures = 0;
+
+// Prints the first few failures; every one of them counts.
+inline void Fail(const std::string& what) {
+    if (++g_failures <= 20)
+        std::cerr << "FAIL " << what << '\n';
+}
+
+inline void Report(const char* name, int cases, const std::string& note = "") {
+    std::cout << name << ": " << cases << " cases" << note << '\n';
+}
+
+inline int ExitCode() {
+    if (g_failures > 0) {
+        std::cerr << g_failures << " failures\n";
+        return 1;
+    }
+    std::cout << "all passed\n";
+    return 0;
+}
+
+// `count` random decimal digits without a leading zero.
+inline std::string RandomDigits(std::mt19937_64& rng, std::size_t count) {
+    std::string text(count, '0');
+    for (char& c : text)
+        c = static_cast<char>('0' + rng() % 10);
+    text[0] = static_cast<char>('1' + rng() % 9);
+    return text;
+}
+
+inline BigNumber RandomInteger(std::mt19937_64& rng, std::size_t digits) {
+    return BigNumber((rng() % 2 ? "-" : "") + RandomDigits(rng, digits));
+}
+
+// Installs a tuning for the lifetime of the guard.
+class ScopedTuning final {
+public:
+    explicit ScopedTuning(const BigNumber::Tuning& tuning) : saved_(BigNumber::GetTuning()) {
+        BigNumber::SetTuning(tuning);
+    }
+    ~ScopedTuning() { BigNumber::SetTuning(saved_); }
+
+    ScopedTuning(const ScopedTuning&) = delete;
+    ScopedTuning& operator=(const ScopedTuning&) = delete;
+
+private:
+    BigNumber::Tuning saved_;
+};
+
+constexpr std::size_t kNever = std::size_t(1) << 40;
+
+// Schoolbook multiplication and Algorithm D only, on the calling thread.
+inline BigNumber::Tuning SimplestTuning() {
+    BigNumber::Tuning tuning;
+    tuning.karatsuba_threshold = kNever;
+    tuning.toom3_threshold = kNever;
+    tuning.ntt_threshold = kNever;
+    tuning.newton_div_threshold = kNever;
+    tuning.threads = 1;
+    return tuning;
+}
+
+#if defined(__SIZEOF_INT128__)
+
+// Reference results are computed in 128-bit integers where there are any.
+using Int128 = __int128;
+
+inline std::string ToString(Int128 value) {
+    if (value == 0)
+        return "0";
+    const bool negative = value < 0;
+    unsigned __int128 magnitude = negative ? -static_cast<unsigned __int128>(value)
+                                           : static_cast<unsigned __int128>(value);
+    std::string text;
+    for (; magnitude != 0; magnitude /= 10)
+        text.insert(text.begin(), static_cast<char>('0' + magnitude % 10));
+    return negative ? "-" + text : text;
+}
+
+inline Int128 Gcd(Int128 a, Int128 b) {
+    if (a < 0)
+        a = -a;
+    while (b != 0) {
+        const Int128 r = a % b;
+        a = b;
+        b = r < 0 ? -r : r;
+    }
+    return a;
+}
+
+// A reduced fraction with den > 0; the arithmetic below gives nullopt once
+// a step overflows.
+struct Fraction {
+    Int128 num;
+    Int128 den;
+};
+
+inline std::optional<Fraction> MakeFraction(Int128 num, Int128 den) {
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    const Int128 g = Gcd(num, den);
+    return Fraction{num / g, den / g};
+}
+
+inline std::optional<Fraction> Combine(const Fraction& a, char op, const Fraction& b) {
+    Int128 p = 0, q = 0, r = 0;
+    switch (op) {
+    case '+':
+    case '-':
+        if (__builtin_mul_overflow(a.num, b.den, &p) || __builtin_mul_overflow(b.num, a.den, &q) ||
+            __builtin_mul_overflow(a.den, b.den, &r))
+            return std::nullopt;
+        if (op == '+' ? __builtin_add_overflow(p, q, &p) : __builtin_sub_overflow(p, q, &p))
+            return std::nullopt;
+        return MakeFraction(p, r);
+    case '*':
+        if (__builtin_mul_overflow(a.num, b.num, &p) || __builtin_mul_overflow(a.den, b.den, &r))
+            return std::nullopt;
+        return MakeFraction(p, r);
+    default:
+        if (__builtin_mul_overflow(a.num, b.den, &p) || __builtin_mul_overflow(a.den, b.num, &r))
+            return std::nullopt;
+        return MakeFraction(p, r);
+    }
+}
+
+// A random expression in the calculator's syntax and its exact value; no
+// value when it divides by zero.
+struct Reference {
+    std::string text;
+    std::optional<Fraction> value;
+    bool overflow = false;
+};
+
+inline Reference RandomReference(std::mt19937_64& rng, int depth) {
+    if (depth == 0 || rng() % 3 == 0) {
+        // Leaves are k or k/100 with k up to 99999, possibly negative.
+        const Int128 k = static_cast<Int128>(rng() % 100000);
+        const bool cents = rng() % 2;
+        const bool negative = rng() % 4 == 0;
+        std::string text = ToString(k);
+        if (cents) {
+            text = std::string(text.size() < 3 ? 3 - text.size() : 0, '0') + text;
+            text.insert(text.size() - 2, ".");
+        }
+        return {(negative ? "-" : "") + text, MakeFraction(negative ? -k : k, cents ? 100 : 1)};
+    }
+
+    static const char kOps[] = "+-*/";
+    const char op = kOps[rng() % 4];
+    const Reference lhs = RandomReference(rng, depth - 1);
+    const Reference rhs = RandomReference(rng, depth - 1);
+    Reference out{"(" + lhs.text + op + rhs.text + ")", std::nullopt,
+                  lhs.overflow || rhs.overflow};
+    if (out.overflow || !lhs.value || !rhs.value)
+        return out;
+    if (op == '/' && rhs.value->num == 0)
+        return out;
+    out.value = Combine(*lhs.value, op, *rhs.value);
+    out.overflow = !out.value;
+    return out;
+}
+
+#endif
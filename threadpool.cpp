@@ -0,0 +1,112 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Set on worker threads so tasks they submit stay on their own deque.
+thread_local const ThreadPool* t_pool = nullptr;
+thread_local std::size_t t_worker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(std::size_t threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    queues_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i)
+        queues_.push_back(std::make_unique<Queue>());
+
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i)
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        const std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::Push(Task task) {
+    const std::size_t index = (t_pool == this)
+        ? t_worker
+        : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    // Counted before it is queued: a thread may take the task the moment
+    // it lands and decrement pending_, which must never go below zero.
+    {
+        const std::lock_guard<std::mutex> lock(wake_mutex_);
+        ++pending_;
+    }
+    {
+        Queue& queue = *queues_[index];
+        const std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::TryPop(std::size_t self, Task* task) {
+    {
+        Queue& own = *queues_[self];
+        const std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t k = 1; k < queues_.size(); ++k) {
+        Queue& victim = *queues_[(self + k) % queues_.size()];
+        const std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+    const std::size_t self = (t_pool == this)
+        ? t_worker
+        : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    Task task;
+    if (!TryPop(self, &task))
+        return false;
+    {
+        const std::lock_guard<std::mutex> lock(wake_mutex_);
+        --pending_;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(std::size_t index) {
+    t_pool = this;
+    t_worker = index;
+
+    for (;;) {
+        Task task;
+        if (TryPop(index, &task)) {
+            {
+                const std::lock_guard<std::mutex> lock(wake_mutex_);
+                --pending_;
+            }
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.wait(lock, [this] { return pending_ > 0 || stopping_; });
+        if (stopping_ && pending_ == 0)
+            return;
+    }
+}
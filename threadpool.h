@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker threads with one task deque each. A worker runs its
+// own newest task first and, once its deque is empty, steals the oldest task
+// of another worker, so uneven tasks still keep every core busy. Tasks
+// submitted from outside the pool are dealt out round-robin; tasks submitted
+// by a worker go to its own deque.
+class ThreadPool final
+{
+public:
+    // Zero means one thread per hardware thread.
+    explicit ThreadPool(std::size_t threads = 0);
+    // Runs the tasks still queued, then joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t Size() const { return workers_.size(); }
+
+    template <typename F>
+    std::future<std::invoke_result_t<std::decay_t<F>>> Submit(F&& task);
+
+    // Runs one queued task on the calling thread and returns true, or
+    // returns false when none is queued. A task that waits for tasks it
+    // submitted calls this instead of blocking, so the pool cannot run out
+    // of threads while work is still queued.
+    bool RunPendingTask();
+
+private:
+    using Task = std::function<void()>;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> next_queue_{0};
+
+    // Tasks pushed but not yet taken, and the shutdown flag; a worker that
+    // finds nothing to run sleeps on wake_ until one of them changes.
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::size_t pending_ = 0;
+    bool stopping_ = false;
+
+    void Push(Task task);
+    bool TryPop(std::size_t self, Task* task);
+    void WorkerLoop(std::size_t index);
+};
+
+template <typename F>
+std::future<std::invoke_result_t<std::decay_t<F>>> ThreadPool::Submit(F&& task) {
+    using Result = std::invoke_result_t<std::decay_t<F>>;
+    // std::function needs a copyable target and packaged_task is move-only.
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    std::future<Result> future = packaged->get_future();
+    Push([packaged] { (*packaged)(); });
+    return future;
+}
@@ -0,0 +1,108 @@
+// ThreadPool under load: futures from several submitting threads, tasks
+// that wait on tasks they submitted, and shutdown with work still queued.
+
+#include "testsupport.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Every future resolves to its own task's result, with several threads
+// submitting at once and stealing from each other's deques.
+void TestSubmit() {
+    constexpr int kSubmitters = 4;
+    constexpr int kTasks = 5000;
+    int cases = 0;
+    for (std::size_t threads : {1, 2, 5}) {
+        ThreadPool pool(threads);
+        std::vector<std::vector<std::future<std::int64_t>>> futures(kSubmitters);
+        std::vector<std::thread> submitters;
+        for (int s = 0; s < kSubmitters; ++s) {
+            submitters.emplace_back([&pool, &futures, s] {
+                for (std::int64_t i = 0; i < kTasks; ++i)
+                    futures[s].push_back(pool.Submit([s, i] { return i * kSubmitters + s; }));
+            });
+        }
+        for (std::thread& submitter : submitters)
+            submitter.join();
+        for (int s = 0; s < kSubmitters; ++s) {
+            for (std::int64_t i = 0; i < kTasks; ++i) {
+                if (futures[s][i].get() != i * kSubmitters + s)
+                    Fail("submit: wrong result on " + std::to_string(threads) + " threads");
+                ++cases;
+            }
+        }
+    }
+    Report("submit", cases);
+}
+
+// Sum of [begin, end) by splitting into tasks; a task waiting for its half
+// runs queued tasks meanwhile, as the parallel kernels do.
+std::int64_t Sum(ThreadPool& pool, std::int64_t begin, std::int64_t end) {
+    if (end - begin <= 16) {
+        std::int64_t sum = 0;
+        for (std::int64_t i = begin; i < end; ++i)
+            sum += i;
+        return sum;
+    }
+    const std::int64_t middle = begin + (end - begin) / 2;
+    std::future<std::int64_t> left =
+        pool.Submit([&pool, begin, middle] { return Sum(pool, begin, middle); });
+    const std::int64_t right = Sum(pool, middle, end);
+    while (left.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        if (!pool.RunPendingTask())
+            std::this_thread::yield();
+    }
+    return left.get() + right;
+}
+
+// Nested tasks finish on pools far smaller than the number of tasks
+// waiting at once.
+void TestNested() {
+    int cases = 0;
+    for (std::size_t threads : {1, 2, 3}) {
+        ThreadPool pool(threads);
+        constexpr std::int64_t kEnd = 100000;
+        const std::int64_t got = pool.Submit([&pool] { return Sum(pool, 0, kEnd); }).get();
+        if (got != kEnd * (kEnd - 1) / 2)
+            Fail("nested: wrong sum on " + std::to_string(threads) + " threads");
+        ++cases;
+    }
+    Report("nested", cases);
+}
+
+// The destructor runs everything still queued before joining.
+void TestShutdown() {
+    int cases = 0;
+    for (std::size_t threads : {1, 4}) {
+        std::atomic<int> done{0};
+        constexpr int kTasks = 20000;
+        {
+            ThreadPool pool(threads);
+            for (int i = 0; i < kTasks; ++i)
+                pool.Submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        if (done.load() != kTasks)
+            Fail("shutdown: " + std::to_string(done.load()) + " of " + std::to_string(kTasks) +
+                 " tasks ran on " + std::to_string(threads) + " threads");
+        ++cases;
+    }
+    Report("shutdown", cases);
+}
+
+} // namespace
+
+int main() {
+    TestSubmit();
+    TestNested();
+    TestShutdown();
+    return ExitCode();
+}